@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// МОНОТОННЫЙ БУФЕР (АРЕНА)
+// Память выделяется сдвигом указателя внутри крупных блоков и никогда
+// не освобождается поштучно. reset() за O(1) делает всю выделенную память
+// снова свободной, а сами блоки остаются для следующего разбора.
+class Arena {
+public:
+    explicit Arena(size_t blockSize = 64 * 1024) : blockSize(blockSize) {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    // Создание объекта в арене. Деструктор объекта никогда не вызывается.
+    template <class T, class... Args>
+    T* make(Args&&... args) {
+        static_assert(std::is_trivially_destructible<T>::value, "Объекты арены не должны требовать деструктора");
+        void* memory = allocate(sizeof(T), alignof(T));
+        return new (memory) T(std::forward<Args>(args)...);
+    }
+
+    void* allocate(size_t size, size_t align) {
+        size_t offset = (used + align - 1) & ~(align - 1);
+        if (current == 0 || offset + size > capacity) {
+            nextBlock(size + align);
+            offset = 0;
+        }
+        used = offset + size;
+        return blocks[current - 1].get() + offset;
+    }
+
+    // Освобождение всех объектов арены
+    void reset() {
+        current = 0;
+        used = 0;
+        capacity = 0;
+        if (!blocks.empty()) nextBlock(0);
+    }
+
+private:
+    void nextBlock(size_t minimum) {
+        // Блоки, оставшиеся от предыдущих разборов, используются повторно
+        if (current < blocks.size() && minimum <= blockSize) {
+            current++;
+        }
+        else {
+            size_t size = minimum > blockSize ? minimum : blockSize;
+            blocks.insert(blocks.begin() + current, std::unique_ptr<char[]>(new char[size]));
+            current++;
+        }
+        used = 0;
+        capacity = minimum > blockSize ? minimum : blockSize;
+    }
+
+    size_t blockSize;
+    std::vector<std::unique_ptr<char[]>> blocks;
+    size_t current = 0;   // Число используемых блоков (текущий - последний из них)
+    size_t used = 0;      // Занято байт в текущем блоке
+    size_t capacity = 0;  // Размер текущего блока
+};
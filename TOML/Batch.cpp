@@ -0,0 +1,228 @@
+#include "Batch.h"
+
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "Cache.h"
+#include "Output.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// Очередь заданий потока. Владелец берёт задания с конца,
+// остальные потоки перехватывают их с начала.
+class WorkQueue {
+public:
+    void push(size_t task) {
+        lock_guard<mutex> lock(guard);
+        tasks.push_back(task);
+    }
+
+    bool pop(size_t& task) {
+        lock_guard<mutex> lock(guard);
+        if (tasks.empty()) return false;
+        task = tasks.back();
+        tasks.pop_back();
+        return true;
+    }
+
+    bool steal(size_t& task) {
+        lock_guard<mutex> lock(guard);
+        if (tasks.empty()) return false;
+        task = tasks.front();
+        tasks.pop_front();
+        return true;
+    }
+
+private:
+    mutex guard;
+    deque<size_t> tasks;
+};
+
+// Результаты прошлых запусков не считаются входными файлами
+static bool isBatchOutput(const fs::path& path) {
+    fs::path extension = path.extension();
+    return extension == ".toml" || extension == ".err";
+}
+
+// Добавление файла или всех файлов каталога
+static void addBatchPath(const string& input, vector<BatchFile>& files, vector<string>& errors) {
+    fs::path root(input);
+    error_code code;
+    if (fs::is_directory(root, code)) {
+        vector<BatchFile> found;
+        for (fs::recursive_directory_iterator it(root, code), end; !code && it != end; it.increment(code)) {
+            if (!it->is_regular_file(code) || isBatchOutput(it->path())) continue;
+            found.push_back({ it->path().string(), it->path().lexically_relative(root).string() });
+        }
+        if (code) {
+            errors.push_back(input + ": " + code.message());
+        }
+        // Порядок обхода каталога не определён, результаты выводятся по имени
+        sort(found.begin(), found.end(), [](const BatchFile& a, const BatchFile& b) { return a.path < b.path; });
+        files.insert(files.end(), found.begin(), found.end());
+    }
+    else if (fs::is_regular_file(root, code)) {
+        files.push_back({ input, root.filename().string() });
+    }
+    else {
+        errors.push_back(input + ": файл не найден");
+    }
+}
+
+// Путь для сравнения файлов: канонический, если его удаётся получить
+static string canonicalPath(const fs::path& path) {
+    error_code code;
+    fs::path canonical = fs::weakly_canonical(path, code);
+    return (code ? path.lexically_normal() : canonical).string();
+}
+
+vector<BatchFile> collectBatchFiles(const vector<string>& inputs, vector<string>& errors) {
+    vector<BatchFile> files;
+    for (const string& input : inputs) {
+        if (input.size() > 1 && input[0] == '@') {
+            ifstream list(input.substr(1));
+            if (!list) {
+                errors.push_back(input.substr(1) + ": не удалось открыть список файлов");
+                continue;
+            }
+            string line;
+            while (getline(list, line)) {
+                if (!line.empty() && line.back() == '\r') line.pop_back();
+                if (!line.empty()) addBatchPath(line, files, errors);
+            }
+        }
+        else {
+            addBatchPath(input, files, errors);
+        }
+    }
+    // Файл, указанный несколько раз (сам и через каталог, разными путями),
+    // преобразуется один раз
+    unordered_set<string> seen;
+    files.erase(remove_if(files.begin(), files.end(), [&](const BatchFile& file) {
+        return !seen.insert(canonicalPath(file.path)).second;
+    }), files.end());
+    return files;
+}
+
+// Путь результата файла без расширения .toml или .err
+static string batchOutputBase(const BatchFile& file, const string& outputDirectory) {
+    if (outputDirectory.empty()) return file.path;
+    return (fs::path(outputDirectory) / file.relative).string();
+}
+
+// Преобразование одного файла. Возвращает пустую строку при успехе
+// или сообщение об ошибке.
+static string convertBatchFile(Converter& converter, const BatchFile& file, const string& outputDirectory, ConversionCache* cache) {
+    string base = batchOutputBase(file, outputDirectory);
+    error_code code;
+    if (!outputDirectory.empty()) fs::create_directories(fs::path(base).parent_path(), code);
+    string tomlPath = base + ".toml";
+    string errorPath = base + ".err";
+
+    ifstream input(file.path);
+    if (!input) return "не удалось открыть файл";
+
+    int fd = openOutputFile(tomlPath.c_str());
+    if (fd < 0) return "не удалось создать файл " + tomlPath;
+    ConversionResult result;
+    if (cache) {
+        // Ключ кэша вычисляется по всему тексту, поэтому файл читается целиком
+        ostringstream text;
+        text << input.rdbuf();
+        result = cache->convert(converter, text.str(), fd);
+    }
+    else {
+        result = converter.convert(input, fd);
+    }
+    // Ошибка записи (например, нет места на диске) уже в result; при
+    // закрытии обнаруживаются ошибки отложенной записи
+    if (!closeOutputFile(fd) && result.success) {
+        result.success = false;
+        result.diagnostic = outputErrorMessage(errno);
+    }
+
+    if (result.success) {
+        fs::remove(errorPath, code);
+        return string();
+    }
+    fs::remove(tomlPath, code);
+    ofstream(errorPath) << result.diagnostic << endl;
+    return result.diagnostic;
+}
+
+BatchSummary convertBatch(const vector<BatchFile>& files, const BatchOptions& options) {
+    unsigned threadCount = options.threads ? options.threads : thread::hardware_concurrency();
+    if (threadCount == 0) threadCount = 1;
+    if (threadCount > files.size()) threadCount = (unsigned)max<size_t>(files.size(), 1);
+
+    // Сообщение об ошибке для каждого файла (пусто - файл преобразован)
+    vector<string> diagnostics(files.size());
+
+    // Файлы с одним результатом перезаписали бы результаты друг друга:
+    // одноимённые файлы из разных каталогов (a/cfg.txt и b/cfg.txt)
+    // в каталоге результатов или один файл, указанный дважды. Преобразуется
+    // первый из них, остальные считаются ошибками. Ошибкой считается и файл,
+    // результат которого заменил бы входной файл пакета (x и x.toml).
+    vector<bool> skipped(files.size(), false);
+    unordered_map<string, size_t> owners;
+    for (size_t i = 0; i < files.size(); i++) owners.emplace(canonicalPath(files[i].path), i);
+    for (size_t i = 0; i < files.size(); i++) {
+        string target = batchOutputBase(files[i], options.outputDirectory) + ".toml";
+        auto inserted = owners.emplace(canonicalPath(target), i);
+        if (inserted.second) continue;
+        const BatchFile& owner = files[inserted.first->second];
+        bool input = canonicalPath(owner.path) == inserted.first->first;
+        diagnostics[i] = "результат " + target + (input ? " совпадает с входным файлом " : " совпадает с результатом файла ") + owner.path;
+        skipped[i] = true;
+    }
+
+    // Файлы делятся между потоками подряд идущими блоками
+    vector<WorkQueue> queues(threadCount);
+    for (unsigned t = 0; t < threadCount; t++) {
+        size_t first = files.size() * t / threadCount;
+        size_t last = files.size() * (t + 1) / threadCount;
+        for (size_t i = first; i < last; i++) {
+            if (!skipped[i]) queues[t].push(i);
+        }
+    }
+
+    auto worker = [&](unsigned self) {
+        Converter converter(options.converter);
+        size_t task;
+        while (true) {
+            bool found = queues[self].pop(task);
+            // Своя очередь пуста - перехват из остальных, начиная со следующей.
+            // Новые задания не появляются, поэтому пустые очереди означают конец.
+            for (unsigned i = 1; !found && i < threadCount; i++) {
+                found = queues[(self + i) % threadCount].steal(task);
+            }
+            if (!found) break;
+            diagnostics[task] = convertBatchFile(converter, files[task], options.outputDirectory, options.cache);
+        }
+    };
+
+    vector<thread> threads;
+    for (unsigned t = 1; t < threadCount; t++) threads.emplace_back(worker, t);
+    worker(0);
+    for (thread& t : threads) t.join();
+
+    BatchSummary summary;
+    for (size_t i = 0; i < files.size(); i++) {
+        if (diagnostics[i].empty()) {
+            summary.converted++;
+        }
+        else {
+            summary.failures.push_back(files[i].path + ": " + diagnostics[i]);
+        }
+    }
+    return summary;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "Converter.h"
+
+class ConversionCache;
+
+// ПАКЕТНОЕ ПРЕОБРАЗОВАНИЕ
+// Файлы распределяются по потокам с перехватом работы: каждый поток берёт
+// задания из своей очереди, а опустошив её, забирает задания из чужих.
+// Каждый поток использует один Converter для всех своих файлов.
+
+// Параметры пакетного преобразования
+struct BatchOptions {
+    ConverterOptions converter;     // Параметры преобразования каждого файла
+    unsigned threads = 0;           // Число потоков (0 - по числу ядер)
+    std::string outputDirectory;    // Каталог результатов (пусто - рядом с входными файлами)
+    ConversionCache* cache = nullptr;   // Общий кэш результатов (nullptr - без кэша)
+};
+
+// Входной файл пакета
+struct BatchFile {
+    std::string path;      // Путь к входному файлу
+    std::string relative;  // Путь относительно каталога результатов
+};
+
+// Итог пакетного преобразования
+struct BatchSummary {
+    size_t converted = 0;              // Успешно преобразованные файлы
+    std::vector<std::string> failures; // Сообщения "файл: ошибка" в порядке файлов
+};
+
+// Сбор входных файлов: каталоги обходятся рекурсивно, "@список" - файл
+// со списком путей по одному в строке. Результаты прошлых запусков
+// (.toml и .err) пропускаются. Файл, указанный несколько раз (сам и через
+// каталог, разными путями), добавляется один раз. Ошибки доступа
+// добавляются в errors.
+std::vector<BatchFile> collectBatchFiles(const std::vector<std::string>& inputs, std::vector<std::string>& errors);
+
+// Преобразование файлов. Для файла name результат пишется в name.toml,
+// а при ошибке сообщение пишется в name.err и name.toml удаляется.
+// Файл, результат которого совпал бы с результатом предыдущего файла или
+// с входным файлом пакета, не преобразуется и считается ошибкой.
+BatchSummary convertBatch(const std::vector<BatchFile>& files, const BatchOptions& options);
@@ -0,0 +1,374 @@
+// Бенчмарк этапов конвейера на синтетических входах.
+// Для каждого вида нагрузки генерируется текст заданного размера и отдельно
+// измеряются сканер, синтаксический анализ S() и семантический анализ
+// с генерацией TOML-кода: время и выделения памяти этапа - разность
+// между обработкой до этого этапа и до предыдущего.
+// Сборка: cmake (цель toml-bench) или
+// g++ -O2 -std=c++17 Bench.cpp Converter.cpp Compiled.cpp Simd.cpp Unicode.cpp -lpthread -o toml-bench
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Converter.h"
+
+using namespace std;
+
+// СЧЁТЧИК ВЫДЕЛЕНИЙ ПАМЯТИ
+// Глобальные operator new и delete заменяются на время всей программы
+static atomic<size_t> allocationCount(0);
+static atomic<size_t> allocationBytes(0);
+
+void* operator new(size_t size) {
+    allocationCount.fetch_add(1, memory_order_relaxed);
+    allocationBytes.fetch_add(size, memory_order_relaxed);
+    if (void* p = malloc(size ? size : 1)) return p;
+    throw bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+// ГЕНЕРАТОРЫ НАГРУЗКИ
+// Каждый генератор дописывает операторы в text, пока тот не достигнет size байт
+struct Workload {
+    const char* name;
+    const char* description;
+    void (*generate)(string& text, size_t size, mt19937_64& random);
+};
+
+static string number(mt19937_64& random, uint64_t limit) {
+    return to_string(random() % limit);
+}
+
+// Слова для строк и комментариев: без кавычек и ограничителей комментариев
+static string words(mt19937_64& random, size_t length) {
+    static const char* const vocabulary[] = {
+        "alpha", "beta", "gamma", "delta", "server", "port", "timeout", "config",
+        "значение", "параметр", "узел", "кластер", "replica", "shard", "region"
+    };
+    string text;
+    while (text.size() < length) {
+        if (!text.empty()) text += ' ';
+        text += vocabulary[random() % (sizeof(vocabulary) / sizeof(vocabulary[0]))];
+    }
+    return text;
+}
+
+// Много констант set со скалярными значениями
+static void generateConstants(string& text, size_t size, mt19937_64& random) {
+    for (size_t i = 0; text.size() < size; i++) {
+        string name = "c" + to_string(i);
+        switch (random() % 3) {
+        case 0:
+            text += "set " + name + " = " + number(random, 1000000000) + ";\n";
+            break;
+        case 1:
+            text += "set " + name + " = \"" + words(random, 16) + "\";\n";
+            break;
+        default:
+            text += "set " + name + (random() % 2 ? " = true;\n" : " = false;\n");
+            break;
+        }
+    }
+}
+
+// Словарь глубины depth с width ключами на каждом уровне
+static void writeDictionary(string& text, size_t depth, size_t width, mt19937_64& random) {
+    text += "{ ";
+    for (size_t k = 0; k < width; k++) {
+        text += "k" + to_string(k) + ": ";
+        if (depth > 1 && k == 0) {
+            writeDictionary(text, depth - 1, width, random);
+            text += "; ";
+        }
+        else {
+            text += number(random, 100000) + "; ";
+        }
+    }
+    text += "}";
+}
+
+// Глубокие и широкие словари верхнего уровня
+static void generateDictionaries(string& text, size_t size, mt19937_64& random) {
+    for (size_t i = 0; text.size() < size; i++) {
+        // Чередуются узкие глубокие, широкие мелкие и средние словари
+        size_t depth = i % 3 == 0 ? 64 : (i % 3 == 1 ? 2 : 8);
+        size_t width = i % 3 == 0 ? 1 : (i % 3 == 1 ? 200 : 6);
+        text += "{ d" + to_string(i) + ": ";
+        writeDictionary(text, depth, width, random);
+        text += "; }\n";
+    }
+}
+
+// Многострочные комментарии %{ %} и строки-комментарии --
+static void generateComments(string& text, size_t size, mt19937_64& random) {
+    for (size_t i = 0; text.size() < size; i++) {
+        if (i % 4 == 3) {
+            text += "-- " + words(random, 60) + "\n";
+            continue;
+        }
+        text += "%{";
+        size_t lines = 5 + random() % 40;
+        for (size_t line = 0; line < lines; line++) {
+            text += "\n  " + words(random, 70);
+        }
+        text += "\n%}\n";
+        text += "set n" + to_string(i) + " = " + number(random, 1000) + ";\n";
+    }
+}
+
+// Частые ссылки $[...] на константы из переменных и словарей
+static void generateReferences(string& text, size_t size, mt19937_64& random) {
+    const size_t constants = 1000;
+    for (size_t i = 0; i < constants; i++) {
+        text += "set r" + to_string(i) + " = \"" + words(random, 24) + "\";\n";
+    }
+    for (size_t i = 0; text.size() < size; i++) {
+        if (i % 2 == 0) {
+            text += "v" + to_string(i) + " = $[r" + number(random, constants) + "];\n";
+            continue;
+        }
+        text += "{ m" + to_string(i) + ": { ";
+        for (size_t k = 0; k < 12; k++) {
+            text += "x" + to_string(k) + ": $[r" + number(random, constants) + "]; ";
+        }
+        text += "}; }\n";
+    }
+}
+
+// Длинные строковые литералы
+static void generateStrings(string& text, size_t size, mt19937_64& random) {
+    for (size_t i = 0; text.size() < size; i++) {
+        size_t length = 1024 + random() % (16 * 1024);
+        if (i % 2 == 0) {
+            text += "set s" + to_string(i) + " = \"" + words(random, length) + "\";\n";
+        }
+        else {
+            text += "{ t" + to_string(i) + ": { body: \"" + words(random, length) + "\"; }; }\n";
+        }
+    }
+}
+
+// Смесь всех видов операторов
+static void generateMixed(string& text, size_t size, mt19937_64& random) {
+    for (size_t i = 0; i < 200; i++) {
+        text += "set host" + to_string(i) + " = \"h" + to_string(i) + ".example.com\";\n";
+    }
+    for (size_t i = 0; text.size() < size; i++) {
+        unsigned kind = random() % 20;
+        string n = to_string(i);
+        if (kind < 8) {
+            text += "{ svc" + n + ": { name: \"s" + n + "\"; port: " + number(random, 65536) +
+                "; host: $[host" + number(random, 200) + "]; opts: { retries: 3; debug: false; }; }; }\n";
+        }
+        else if (kind < 12) {
+            text += "set k" + n + " = " + number(random, 1000000) + ";\n";
+        }
+        else if (kind < 15) {
+            text += "v" + n + " = $[host" + number(random, 200) + "];\n";
+        }
+        else if (kind < 17) {
+            text += "-- comment line " + n + "\n";
+        }
+        else {
+            text += "%{ block\n comment " + n + " %}\n";
+        }
+    }
+}
+
+static const Workload workloads[] = {
+    { "constants", "константы set", generateConstants },
+    { "dictionaries", "глубокие и широкие словари", generateDictionaries },
+    { "comments", "комментарии %{ %} и --", generateComments },
+    { "references", "ссылки $[...]", generateReferences },
+    { "strings", "длинные строки", generateStrings },
+    { "mixed", "смесь операторов", generateMixed },
+};
+
+// ИЗМЕРЕНИЕ
+struct StageMeasure {
+    double seconds = 1e30;      // Лучшее время из всех запусков
+    size_t allocations = 0;     // Выделения памяти за последний запуск
+    size_t allocatedBytes = 0;
+    ConversionCounters counters;
+};
+
+static StageMeasure measureStage(Converter& converter, const string& text, ConversionStage stage, int runs) {
+    StageMeasure measure;
+    for (int run = 0; run < runs; run++) {
+        size_t count = allocationCount.load();
+        size_t bytes = allocationBytes.load();
+        auto start = chrono::steady_clock::now();
+        ConversionResult result = converter.runStage(text, stage);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        measure.allocations = allocationCount.load() - count;
+        measure.allocatedBytes = allocationBytes.load() - bytes;
+        if (!result.success) {
+            printf("ошибка преобразования: %s\n", result.diagnostic.c_str());
+            exit(1);
+        }
+        measure.seconds = min(measure.seconds, seconds);
+        measure.counters = converter.counters();
+    }
+    return measure;
+}
+
+// Время этапа - разность лучших времён; из-за разброса она может
+// оказаться отрицательной, тогда этап считается мгновенным
+static double stageSeconds(double total, double before) {
+    return max(total - before, 0.0);
+}
+
+// Наименьший различимый шаг steady_clock в секундах
+static double clockResolution() {
+    double best = 1e30;
+    for (int i = 0; i < 1000; i++) {
+        auto start = chrono::steady_clock::now();
+        auto next = chrono::steady_clock::now();
+        while (next == start) next = chrono::steady_clock::now();
+        best = min(best, chrono::duration<double>(next - start).count());
+    }
+    return best;
+}
+
+// Строка этапа. Этап короче разрешения часов печатается прочерками:
+// скорость, делённая на почти нулевое время, ничего не значит.
+// Ширина поля printf считается в байтах, а "—" занимает три байта.
+static void printStage(const char* name, double seconds, double resolution, double megabytes,
+    size_t items, const char* unit, size_t allocations, size_t bytes) {
+    if (seconds < resolution) {
+        printf("  %-18s %11s мс %11s МБ/с %14s %s %10zu выделений %12zu байт\n", name,
+            "—", "—", "—", unit, allocations, bytes);
+        return;
+    }
+    printf("  %-18s %9.1f мс %9.1f МБ/с %12.0f %s %10zu выделений %12zu байт\n", name,
+        seconds * 1e3, megabytes / seconds, items / seconds, unit, allocations, bytes);
+}
+
+static size_t stageCount(size_t total, size_t before) {
+    return total > before ? total - before : 0;
+}
+
+static void benchmark(const string& name, const string& text, int runs) {
+    Converter converter;
+    // Первый проход прогревает буферы конвейера и страницы текста
+    converter.runStage(text, ConversionStage::Analyze);
+
+    StageMeasure scan = measureStage(converter, text, ConversionStage::Scan, runs);
+    StageMeasure parse = measureStage(converter, text, ConversionStage::Parse, runs);
+    StageMeasure analyze = measureStage(converter, text, ConversionStage::Analyze, runs);
+
+    double megabytes = text.size() / 1e6;
+    double scanTime = stageSeconds(scan.seconds, 0);
+    double parseTime = stageSeconds(parse.seconds, scan.seconds);
+    double analyzeTime = stageSeconds(analyze.seconds, parse.seconds);
+
+    printf("%s: %.1f МБ, токенов %zu, узлов %zu, операторов %zu\n", name.c_str(), megabytes,
+        scan.counters.tokens, parse.counters.nodes, parse.counters.statements);
+    static const double resolution = clockResolution();
+    printStage("scanner", scanTime, resolution, megabytes, scan.counters.tokens, "токенов/с",
+        scan.allocations, scan.allocatedBytes);
+    printStage("S", parseTime, resolution, megabytes, parse.counters.nodes, "узлов/с  ",
+        stageCount(parse.allocations, scan.allocations), stageCount(parse.allocatedBytes, scan.allocatedBytes));
+    printStage("semanticAnalysis", analyzeTime, resolution, megabytes, analyze.counters.nodes, "узлов/с  ",
+        stageCount(analyze.allocations, parse.allocations), stageCount(analyze.allocatedBytes, parse.allocatedBytes));
+    // Ширина поля printf считается в байтах, поэтому кириллица выравнивается вручную
+    printf("  всего              %9.1f мс %9.1f МБ/с\n", analyze.seconds * 1e3, megabytes / analyze.seconds);
+}
+
+static void usage() {
+    printf("Использование: toml-bench [--size МБ] [--runs N] [--seed N] [--workload ИМЯ]... [--input ФАЙЛ]\n");
+    printf("               toml-bench --generate ИМЯ [--size МБ] [--seed N] > ФАЙЛ\n");
+    printf("Виды нагрузки:\n");
+    for (const Workload& workload : workloads) printf("  %-14s %s\n", workload.name, workload.description);
+}
+
+static const Workload* findWorkload(const string& name) {
+    for (const Workload& workload : workloads) {
+        if (name == workload.name) return &workload;
+    }
+    return nullptr;
+}
+
+int main(int argc, char* argv[]) {
+    double sizeMb = 16;
+    int runs = 3;
+    uint64_t seed = 1;
+    vector<const Workload*> selected;
+    vector<string> inputs;
+    const Workload* generate = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--size" && i + 1 < argc) {
+            sizeMb = atof(argv[++i]);
+        }
+        else if (arg == "--runs" && i + 1 < argc) {
+            runs = max(atoi(argv[++i]), 1);
+        }
+        else if (arg == "--seed" && i + 1 < argc) {
+            seed = strtoull(argv[++i], nullptr, 10);
+        }
+        else if ((arg == "--workload" || arg == "--generate") && i + 1 < argc) {
+            const Workload* workload = findWorkload(argv[++i]);
+            if (!workload) {
+                printf("Неизвестный вид нагрузки: %s\n", argv[i]);
+                usage();
+                return 1;
+            }
+            if (arg == "--generate") generate = workload;
+            else selected.push_back(workload);
+        }
+        else if (arg == "--input" && i + 1 < argc) {
+            inputs.push_back(argv[++i]);
+        }
+        else {
+            usage();
+            return arg == "--help" ? 0 : 1;
+        }
+    }
+
+    size_t size = (size_t)(sizeMb * 1e6);
+    if (generate) {
+        mt19937_64 random(seed);
+        string text;
+        generate->generate(text, size, random);
+        fwrite(text.data(), 1, text.size(), stdout);
+        return 0;
+    }
+
+    for (const string& path : inputs) {
+        ifstream file(path, ios::binary);
+        if (!file) {
+            printf("Не удалось открыть файл %s\n", path.c_str());
+            return 1;
+        }
+        ostringstream text;
+        text << file.rdbuf();
+        benchmark(path, text.str(), runs);
+    }
+    if (selected.empty() && inputs.empty()) {
+        for (const Workload& workload : workloads) selected.push_back(&workload);
+    }
+    for (const Workload* workload : selected) {
+        mt19937_64 random(seed);
+        string text;
+        workload->generate(text, size, random);
+        benchmark(workload->name, text, runs);
+    }
+    return 0;
+}
@@ -0,0 +1,309 @@
+#include "Cache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <system_error>
+#include <vector>
+
+#include "Output.h"
+
+using namespace std;
+namespace fs = std::filesystem;
+
+// ХЕШ КЛЮЧА
+// Ключ - SHA-256 (FIPS 180-4) параметров преобразования и текста. Имя
+// записи - первые 16 байт хеша; заголовок записи хранит длину текста и весь
+// хеш, и load() сверяет их перед тем, как вернуть TOML-код. Поэтому
+// совпадение 128-битных имён приводит только к промаху, а подобрать вход
+// под чужую запись так же трудно, как найти коллизию SHA-256.
+static const uint32_t SHA256_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t rotateRight(uint32_t x, int r) {
+    return (x >> r) | (x << (32 - r));
+}
+
+class Sha256 {
+public:
+    void update(const void* data, size_t size) {
+        const unsigned char* p = static_cast<const unsigned char*>(data);
+        total += size;
+        if (used > 0) {
+            size_t take = min(size, sizeof(block) - used);
+            memcpy(block + used, p, take);
+            used += take;
+            p += take;
+            size -= take;
+            if (used < sizeof(block)) return;
+            compress(block);
+            used = 0;
+        }
+        for (; size >= sizeof(block); p += sizeof(block), size -= sizeof(block)) compress(p);
+        memcpy(block, p, size);
+        used = size;
+    }
+
+    void finish(uint8_t digest[32]) {
+        uint64_t bits = total * 8;
+        unsigned char padding[72] = { 0x80 };
+        size_t length = (used < 56 ? 56 : 120) - used;
+        for (int i = 0; i < 8; i++) padding[length + i] = (unsigned char)(bits >> (56 - 8 * i));
+        update(padding, length + 8);
+        for (int i = 0; i < 8; i++) {
+            for (int b = 0; b < 4; b++) digest[4 * i + b] = (uint8_t)(state[i] >> (24 - 8 * b));
+        }
+    }
+
+private:
+    void compress(const unsigned char* p) {
+        uint32_t w[64];
+        for (int i = 0; i < 16; i++) {
+            w[i] = (uint32_t)p[4 * i] << 24 | (uint32_t)p[4 * i + 1] << 16 | (uint32_t)p[4 * i + 2] << 8 | p[4 * i + 3];
+        }
+        for (int i = 16; i < 64; i++) {
+            uint32_t s0 = rotateRight(w[i - 15], 7) ^ rotateRight(w[i - 15], 18) ^ (w[i - 15] >> 3);
+            uint32_t s1 = rotateRight(w[i - 2], 17) ^ rotateRight(w[i - 2], 19) ^ (w[i - 2] >> 10);
+            w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+        uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+        uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+        for (int i = 0; i < 64; i++) {
+            uint32_t t1 = h + (rotateRight(e, 6) ^ rotateRight(e, 11) ^ rotateRight(e, 25)) + ((e & f) ^ (~e & g)) + SHA256_K[i] + w[i];
+            uint32_t t2 = (rotateRight(a, 2) ^ rotateRight(a, 13) ^ rotateRight(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + t1;
+            d = c;
+            c = b;
+            b = a;
+            a = t1 + t2;
+        }
+        state[0] += a;
+        state[1] += b;
+        state[2] += c;
+        state[3] += d;
+        state[4] += e;
+        state[5] += f;
+        state[6] += g;
+        state[7] += h;
+    }
+
+    uint32_t state[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+    unsigned char block[64];
+    size_t used = 0;
+    uint64_t total = 0;
+};
+
+string CacheKey::hex() const {
+    static const char digits[] = "0123456789abcdef";
+    string text(32, '0');
+    for (int i = 0; i < 16; i++) {
+        text[2 * i] = digits[digest[i] >> 4];
+        text[2 * i + 1] = digits[digest[i] & 15];
+    }
+    return text;
+}
+
+// Записи кэша и временные файлы недописанных записей
+static const char ENTRY_EXTENSION[] = ".toml";
+static const char TEMP_EXTENSION[] = ".tmp";
+
+// Заголовок записи: метка формата, длина входного текста (little-endian)
+// и SHA-256 ключа; за ним - TOML-код
+static const char ENTRY_MAGIC[8] = { 'T', 'O', 'M', 'L', 'C', 'A', 'C', '2' };
+static const size_t ENTRY_HEADER = sizeof(ENTRY_MAGIC) + 8 + 32;
+
+static void entryHeader(const CacheKey& key, char header[ENTRY_HEADER]) {
+    memcpy(header, ENTRY_MAGIC, sizeof(ENTRY_MAGIC));
+    for (int i = 0; i < 8; i++) header[sizeof(ENTRY_MAGIC) + i] = (char)(key.length >> (8 * i));
+    memcpy(header + sizeof(ENTRY_MAGIC) + 8, key.digest, sizeof(key.digest));
+}
+
+ConversionCache::ConversionCache(const string& directory, uint64_t maxBytes)
+    : directory(directory), maxBytes(maxBytes) {
+    error_code code;
+    fs::create_directories(directory, code);
+    uint64_t total = 0;
+    for (fs::directory_iterator it(directory, code), end; !code && it != end; it.increment(code)) {
+        if (it->path().extension() == ENTRY_EXTENSION) total += it->file_size(code);
+    }
+    totalBytes = total;
+    // Предел мог уменьшиться с прошлого запуска
+    if (maxBytes > 0 && total > maxBytes) evict();
+    // Имена временных файлов различаются между процессами, использующими кэш
+    random_device random;
+    instance = ((uint64_t)random() << 32) ^ random() ^ (uint64_t)chrono::steady_clock::now().time_since_epoch().count();
+}
+
+CacheKey ConversionCache::key(string_view text, const ConverterOptions& options) {
+    // Потоки и печать токенов и AST на TOML-код не влияют
+    unsigned char parameters[13];
+    uint32_t version = CONVERTER_VERSION;
+    uint64_t depth = options.maxDepth;
+    for (int i = 0; i < 4; i++) parameters[i] = (unsigned char)(version >> (8 * i));
+    for (int i = 0; i < 8; i++) parameters[4 + i] = (unsigned char)(depth >> (8 * i));
+    parameters[12] = options.stripComments ? 1 : 0;
+    Sha256 hash;
+    hash.update(parameters, sizeof(parameters));
+    hash.update(text.data(), text.size());
+    CacheKey key;
+    hash.finish(key.digest);
+    key.length = text.size();
+    return key;
+}
+
+bool ConversionCache::load(const CacheKey& key, string& toml) {
+    fs::path path = fs::path(directory) / (key.hex() + ENTRY_EXTENSION);
+    ifstream file(path, ios::binary);
+    if (file) {
+        file.seekg(0, ios::end);
+        streamoff size = file.tellg();
+        file.seekg(0, ios::beg);
+        // Запись другого текста с тем же именем или старого формата - промах
+        char expected[ENTRY_HEADER], header[ENTRY_HEADER];
+        entryHeader(key, expected);
+        if (size >= (streamoff)ENTRY_HEADER && file.read(header, ENTRY_HEADER) &&
+            memcmp(header, expected, ENTRY_HEADER) == 0) {
+            toml.resize((size_t)size - ENTRY_HEADER);
+            if (file.read(&toml[0], toml.size())) {
+                error_code code;
+                fs::last_write_time(path, fs::file_time_type::clock::now(), code);
+                hits++;
+                return true;
+            }
+        }
+        toml.clear();
+    }
+    misses++;
+    return false;
+}
+
+void ConversionCache::store(const CacheKey& key, string_view toml) {
+    string name = key.hex();
+    fs::path target = fs::path(directory) / (name + ENTRY_EXTENSION);
+    fs::path temp = fs::path(directory) / (name + "." + to_string(instance) + "." + to_string(tempCounter++) + TEMP_EXTENSION);
+    error_code code;
+    {
+        char header[ENTRY_HEADER];
+        entryHeader(key, header);
+        ofstream file(temp, ios::binary | ios::trunc);
+        if (!file.write(header, ENTRY_HEADER) || !file.write(toml.data(), toml.size()) || !file.flush()) {
+            file.close();
+            fs::remove(temp, code);
+            return;
+        }
+    }
+    // Запись с тем же ключом могла уже добавить другая задача пакета или
+    // другой процесс; она заменяется, и её размер не учитывается дважды
+    uint64_t replaced = 0;
+    if (maxBytes > 0) {
+        uint64_t size = fs::file_size(target, code);
+        if (!code) replaced = size;
+    }
+    // Переименование атомарно: читатели видят либо всю запись, либо ничего
+    fs::rename(temp, target, code);
+    if (code) {
+        fs::remove(temp, code);
+        return;
+    }
+    stores++;
+    if (maxBytes == 0) return;
+    uint64_t total = totalBytes.load();
+    uint64_t updated;
+    do {
+        updated = total + ENTRY_HEADER + toml.size();
+        updated -= min(replaced, updated);
+    } while (!totalBytes.compare_exchange_weak(total, updated));
+    if (updated > maxBytes) evict();
+}
+
+void ConversionCache::evict() {
+    lock_guard<mutex> lock(evictGuard);
+    if (totalBytes <= maxBytes) return;
+
+    struct Entry {
+        fs::path path;
+        fs::file_time_type used;
+        uint64_t size;
+    };
+    vector<Entry> entries;
+    uint64_t total = 0;
+    error_code code;
+    auto staleTemp = fs::file_time_type::clock::now() - chrono::hours(1);
+    for (fs::directory_iterator it(directory, code), end; !code && it != end; it.increment(code)) {
+        error_code entryCode;
+        fs::file_time_type used = it->last_write_time(entryCode);
+        if (entryCode) continue;
+        fs::path extension = it->path().extension();
+        if (extension == ENTRY_EXTENSION) {
+            uint64_t size = it->file_size(entryCode);
+            if (entryCode) continue;
+            entries.push_back({ it->path(), used, size });
+            total += size;
+        }
+        else if (extension == TEMP_EXTENSION && used < staleTemp) {
+            // Остатки записей, прерванных завершением процесса
+            fs::remove(it->path(), entryCode);
+        }
+    }
+
+    // Удаление до трёх четвертей предела, чтобы не сканировать каталог
+    // после каждой новой записи
+    sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+    uint64_t target = maxBytes - maxBytes / 4;
+    for (size_t i = 0; i < entries.size() && total > target; i++) {
+        if (fs::remove(entries[i].path, code)) {
+            total -= entries[i].size;
+            evictions++;
+        }
+    }
+    totalBytes = total;
+}
+
+ConversionResult ConversionCache::convert(Converter& converter, string_view text, int fd, CacheLookup* lookup) {
+    CacheKey entry = key(text, converter.options());
+    ConversionResult result;
+    bool hit = load(entry, result.toml);
+    if (lookup) lookup->hit = hit;
+    if (hit) {
+        result.success = true;
+    }
+    else {
+        result = converter.convert(text);
+        if (result.success) store(entry, result.toml);
+    }
+    // Как и при выводе в дескриптор без кэша, при ошибке в fd остаётся
+    // TOML-код операторов, разобранных до неё
+    OutputBuffer output(fd, 1 << 16);
+    if (lookup) output.setStats(&lookup->output);
+    output.write(result.toml);
+    output.flush();
+    if (result.success && output.error()) {
+        result.success = false;
+        result.diagnostic = outputErrorMessage(output.error());
+    }
+    result.toml.clear();
+    return result;
+}
+
+CacheStats ConversionCache::stats() const {
+    CacheStats result;
+    result.hits = hits;
+    result.misses = misses;
+    result.stores = stores;
+    result.evictions = evictions;
+    return result;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+#include "Converter.h"
+#include "Output.h"
+
+// КЭШ РЕЗУЛЬТАТОВ ПРЕОБРАЗОВАНИЯ
+// Результат хранится в каталоге кэша под хешем SHA-256 входного текста,
+// версии преобразователя и параметров, влияющих на результат; запись
+// возвращается, только если совпадают весь хеш и длина текста. При попадании
+// TOML-код берётся из кэша без сканирования и анализа. Новые записи пишутся
+// во временный файл и переименовываются, поэтому кэш могут одновременно
+// использовать несколько потоков и процессов. Когда суммарный размер записей
+// превышает предел, удаляются записи, дольше всего не использовавшиеся
+// (время использования - время изменения файла записи).
+
+// Ключ записи кэша: SHA-256 параметров и текста и длина текста
+struct CacheKey {
+    uint8_t digest[32] = {};
+    uint64_t length = 0;
+
+    // Имя записи: первые 16 байт хеша в шестнадцатеричном виде
+    std::string hex() const;
+};
+
+// Счётчики кэша
+struct CacheStats {
+    uint64_t hits = 0;       // TOML-код взят из кэша
+    uint64_t misses = 0;     // Текст преобразован заново
+    uint64_t stores = 0;     // Записи, добавленные в кэш
+    uint64_t evictions = 0;  // Записи, удалённые при превышении размера
+};
+
+// Сведения об одном преобразовании через кэш
+struct CacheLookup {
+    bool hit = false;       // TOML-код взят из кэша без преобразования
+    OutputStats output;     // Байты, записанные в fd, и время записи
+};
+
+class ConversionCache {
+public:
+    // Каталог создаётся при необходимости. maxBytes - предел суммарного
+    // размера записей (0 - без ограничения).
+    ConversionCache(const std::string& directory, uint64_t maxBytes);
+
+    ConversionCache(const ConversionCache&) = delete;
+    ConversionCache& operator=(const ConversionCache&) = delete;
+
+    // Ключ текста при данных параметрах преобразования
+    static CacheKey key(std::string_view text, const ConverterOptions& options);
+
+    // Поиск записи; при попадании запись отмечается как использованная.
+    // Запись с другим хешем или длиной текста в заголовке - промах.
+    bool load(const CacheKey& key, std::string& toml);
+
+    // Добавление записи (ошибки записи не считаются ошибками преобразования)
+    void store(const CacheKey& key, std::string_view toml);
+
+    // Преобразование с использованием кэша: TOML-код пишется в fd.
+    // Ошибки преобразования не кэшируются. lookup (если не nullptr)
+    // получает сведения о попадании и выводе.
+    ConversionResult convert(Converter& converter, std::string_view text, int fd, CacheLookup* lookup = nullptr);
+
+    CacheStats stats() const;
+
+private:
+    void evict();
+
+    std::string directory;
+    uint64_t maxBytes;
+    std::atomic<uint64_t> totalBytes{ 0 };   // Оценка суммарного размера записей
+    std::atomic<uint64_t> hits{ 0 };
+    std::atomic<uint64_t> misses{ 0 };
+    std::atomic<uint64_t> stores{ 0 };
+    std::atomic<uint64_t> evictions{ 0 };
+    uint64_t instance = 0;                   // Случайная метка объекта в именах временных файлов
+    std::atomic<uint64_t> tempCounter{ 0 };
+    std::mutex evictGuard;
+};
@@ -0,0 +1,361 @@
+#include "Compiled.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "Converter.h"
+#include "Output.h"
+#include "Simd.h"
+
+using namespace std;
+
+static const char COMPILED_MAGIC[8] = { 'T', 'O', 'M', 'L', 'B', 'I', 'N', '\0' };
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+static uint64_t alignUp(uint64_t value) {
+    return (value + 7) & ~(uint64_t)7;
+}
+
+string_view CompiledEntry::string() const {
+    if (type == COMPILED_STRING && text.size() >= 2) return text.substr(1, text.size() - 2);
+    return text;
+}
+
+// СБОРКА ОБРАЗА
+size_t CompiledWriter::PoolHash::operator()(const PooledString& s) const {
+    return hash<string_view>()(string_view(pool->data() + s.offset, s.length));
+}
+
+bool CompiledWriter::PoolEqual::operator()(const PooledString& a, const PooledString& b) const {
+    return a.length == b.length && memcmp(pool->data() + a.offset, pool->data() + b.offset, a.length) == 0;
+}
+
+// Строка добавляется в конец пула и, если такая уже есть, отрезается обратно
+uint64_t CompiledWriter::intern(string_view text) {
+    PooledString candidate = { strings.size(), text.size() };
+    strings.append(text.data(), text.size());
+    auto inserted = pooled.insert(candidate);
+    if (!inserted.second) {
+        strings.resize(candidate.offset);
+        return inserted.first->offset;
+    }
+    return candidate.offset;
+}
+
+void CompiledWriter::comment(string_view body) {
+    CompiledRecord record = {};
+    record.kind = COMPILED_COMMENT;
+    record.text = intern(body);
+    record.textLength = body.size();
+    records.push_back(record);
+}
+
+static const uint64_t NO_NAME = UINT64_MAX;
+static const uint32_t NO_RECORD = UINT32_MAX;
+
+bool CompiledWriter::hasPath(uint32_t path) const {
+    return path < pathNames.size() && pathNames[path].length != NO_NAME;
+}
+
+// Имена путей различны, поэтому добавляются в пул без поиска повторов
+void CompiledWriter::definePath(uint32_t path, string_view name) {
+    if (path >= pathNames.size()) {
+        pathNames.resize(path + 1, { 0, NO_NAME });
+        lastRecord.resize(path + 1, NO_RECORD);
+    }
+    pathNames[path] = { strings.size(), name.size() };
+    strings.append(name.data(), name.size());
+}
+
+CompiledRecord& CompiledWriter::add(CompiledKind kind, uint32_t path) {
+    lastRecord[path] = (uint32_t)records.size();
+    records.emplace_back();
+    CompiledRecord& record = records.back();
+    record = {};
+    record.kind = kind;
+    record.path = pathNames[path].offset;
+    record.pathLength = (uint32_t)pathNames[path].length;
+    return record;
+}
+
+void CompiledWriter::table(uint32_t path) {
+    add(COMPILED_TABLE, path);
+}
+
+void CompiledWriter::value(uint32_t path, string_view toml) {
+    CompiledRecord& record = add(COMPILED_VALUE, path);
+    record.text = intern(toml);
+    record.textLength = toml.size();
+    // Тип восстанавливается по TOML-коду значения: строки в кавычках,
+    // логические значения - ключевые слова, остальное - числа. Числа
+    // записаны преобразователем в каноническом виде, поэтому значение
+    // восстанавливается точно.
+    if (!toml.empty() && toml[0] == '"') {
+        record.type = COMPILED_STRING;
+    }
+    else if (toml == "true" || toml == "false") {
+        record.type = COMPILED_BOOLEAN;
+        record.integer = toml == "true";
+    }
+    else {
+        const char* end = toml.data() + toml.size();
+        from_chars_result parsed = from_chars(toml.data(), end, record.integer);
+        record.type = COMPILED_INTEGER;
+        if (parsed.ec != errc() || parsed.ptr != end) {
+            record.type = COMPILED_FLOAT;
+            record.number = 0;
+            from_chars(toml.data(), end, record.number);
+        }
+    }
+}
+
+void CompiledWriter::clear() {
+    records.clear();
+    pathNames.clear();
+    lastRecord.clear();
+    strings.clear();
+    pooled.clear();
+}
+
+void CompiledWriter::serialize(string& image) const {
+    // Указатель ключей: для каждого пути последняя запись
+    vector<uint32_t> keys;
+    for (uint32_t index : lastRecord) {
+        if (index != NO_RECORD) keys.push_back(index);
+    }
+    auto pathOf = [&](uint32_t index) {
+        return string_view(strings.data() + records[index].path, records[index].pathLength);
+    };
+    sort(keys.begin(), keys.end(), [&](uint32_t a, uint32_t b) { return pathOf(a) < pathOf(b); });
+
+    CompiledHeader header = {};
+    memcpy(header.magic, COMPILED_MAGIC, sizeof(header.magic));
+    header.byteOrder = BYTE_ORDER_MARK;
+    header.formatVersion = COMPILED_FORMAT_VERSION;
+    header.converterVersion = CONVERTER_VERSION;
+    header.recordsOffset = alignUp(sizeof(CompiledHeader));
+    header.recordCount = records.size();
+    header.keysOffset = alignUp(header.recordsOffset + records.size() * sizeof(CompiledRecord));
+    header.keyCount = keys.size();
+    header.stringsOffset = alignUp(header.keysOffset + keys.size() * sizeof(uint32_t));
+    header.stringsSize = strings.size();
+    header.fileSize = header.stringsOffset + strings.size();
+
+    // Промежутки между разделами заполняются нулями
+    image.assign((size_t)header.fileSize, '\0');
+    memcpy(&image[0], &header, sizeof(header));
+    if (!records.empty()) memcpy(&image[(size_t)header.recordsOffset], records.data(), records.size() * sizeof(CompiledRecord));
+    if (!keys.empty()) memcpy(&image[(size_t)header.keysOffset], keys.data(), keys.size() * sizeof(uint32_t));
+    if (!strings.empty()) memcpy(&image[(size_t)header.stringsOffset], strings.data(), strings.size());
+}
+
+bool CompiledWriter::write(const string& path, string& error) {
+    string image;
+    serialize(image);
+    ofstream file(path, ios::binary | ios::trunc);
+    if (!file) {
+        error = "не удалось создать файл " + path;
+        return false;
+    }
+    file.write(image.data(), (streamsize)image.size());
+    if (!file.flush()) {
+        error = "не удалось записать файл " + path;
+        return false;
+    }
+    return true;
+}
+
+// ЧТЕНИЕ ОБРАЗА
+CompiledConfig::~CompiledConfig() {
+    close();
+}
+
+void CompiledConfig::close() {
+    if (data && data != memory.data()) {
+#ifndef _WIN32
+        if (mapped) munmap((void*)data, dataSize);
+        else delete[] data;
+#else
+        delete[] data;
+#endif
+    }
+    memory.clear();
+    memory.shrink_to_fit();
+    data = nullptr;
+    dataSize = 0;
+    mapped = false;
+    header = nullptr;
+    records = nullptr;
+    keys = nullptr;
+    strings = nullptr;
+}
+
+bool CompiledConfig::open(const string& path, string& error) {
+    close();
+#ifndef _WIN32
+    // Файл отображается только для чтения: страницы разделяются
+    // со страничным кэшем и подгружаются при первом обращении
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        error = "не удалось открыть файл " + path;
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* view = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (view != MAP_FAILED) {
+            data = (const char*)view;
+            dataSize = (size_t)info.st_size;
+            mapped = true;
+        }
+    }
+    ::close(fd);
+#else
+    ifstream file(path, ios::binary | ios::ate);
+    if (file) {
+        streamoff size = file.tellg();
+        if (size > 0) {
+            char* buffer = new char[(size_t)size];
+            file.seekg(0);
+            if (file.read(buffer, size)) {
+                data = buffer;
+                dataSize = (size_t)size;
+            }
+            else {
+                delete[] buffer;
+            }
+        }
+    }
+#endif
+    if (!data) {
+        error = "не удалось прочитать файл " + path;
+        return false;
+    }
+    return attach(path, error);
+}
+
+bool CompiledConfig::load(string image, string& error) {
+    close();
+    memory = move(image);
+    data = memory.data();
+    dataSize = memory.size();
+    return attach("образ в памяти", error);
+}
+
+// Проверка заголовка и разделов образа data; path - имя образа в сообщениях
+bool CompiledConfig::attach(const string& path, string& error) {
+    header = (const CompiledHeader*)data;
+    bool valid = dataSize >= sizeof(CompiledHeader) && memcmp(header->magic, COMPILED_MAGIC, sizeof(COMPILED_MAGIC)) == 0;
+    if (valid && (header->byteOrder != BYTE_ORDER_MARK || header->formatVersion != COMPILED_FORMAT_VERSION)) {
+        error = path + ": неподдерживаемая версия или порядок байтов образа";
+        close();
+        return false;
+    }
+    // Разделы должны лежать внутри файла и быть выровнены
+    valid = valid && header->fileSize == dataSize
+        && header->recordsOffset % 8 == 0 && header->keysOffset % 8 == 0
+        && header->recordsOffset <= dataSize && header->recordCount <= (dataSize - header->recordsOffset) / sizeof(CompiledRecord)
+        && header->keysOffset <= dataSize && header->keyCount <= (dataSize - header->keysOffset) / sizeof(uint32_t)
+        && header->stringsOffset <= dataSize && header->stringsSize <= dataSize - header->stringsOffset;
+    if (!valid) {
+        error = path + ": файл не является скомпилированным документом";
+        close();
+        return false;
+    }
+    records = (const CompiledRecord*)(data + header->recordsOffset);
+    keys = (const uint32_t*)(data + header->keysOffset);
+    strings = data + header->stringsOffset;
+    return true;
+}
+
+size_t CompiledConfig::size() const {
+    return header ? (size_t)header->recordCount : 0;
+}
+
+// Строка пула; ссылки за пределы пула считаются пустыми строками
+string_view CompiledConfig::pooled(uint64_t offset, uint64_t length) const {
+    if (offset > header->stringsSize || length > header->stringsSize - offset) return string_view();
+    return string_view(strings + offset, (size_t)length);
+}
+
+CompiledEntry CompiledConfig::entry(size_t index) const {
+    const CompiledRecord& record = records[index];
+    CompiledEntry result;
+    result.kind = (CompiledKind)record.kind;
+    result.type = (CompiledType)record.type;
+    result.path = pooled(record.path, record.pathLength);
+    result.text = pooled(record.text, record.textLength);
+    if (result.type == COMPILED_FLOAT) result.number = record.number;
+    else result.integer = record.integer;
+    return result;
+}
+
+bool CompiledConfig::find(string_view path, CompiledEntry& result) const {
+    if (!header) return false;
+    // Двоичный поиск по упорядоченному указателю ключей
+    size_t low = 0;
+    size_t high = (size_t)header->keyCount;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        uint32_t index = keys[middle];
+        if (index >= header->recordCount) return false;
+        string_view candidate = pooled(records[index].path, records[index].pathLength);
+        if (candidate < path) {
+            low = middle + 1;
+        }
+        else if (path < candidate) {
+            high = middle;
+        }
+        else {
+            result = entry(index);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CompiledConfig::writeToml(int fd, string& error) const {
+    OutputBuffer out(fd);
+    for (size_t i = 0; i < size(); i++) {
+        CompiledEntry record = entry(i);
+        if (record.kind == COMPILED_COMMENT) {
+            // Каждая строка тела - отдельная строка "# ...", как при преобразовании
+            string_view text = record.text;
+            while (!text.empty()) {
+                const char* end = findByte(text.data(), text.data() + text.size(), '\n');
+                size_t length = end - text.data();
+                out.write("# ");
+                out.write(text.substr(0, length));
+                out.put('\n');
+                text.remove_prefix(length < text.size() ? length + 1 : length);
+            }
+        }
+        else if (record.kind == COMPILED_TABLE) {
+            // Пути хранятся без кавычек; в TOML-коде они пишутся, как при преобразовании
+            out.put('[');
+            writeKeyPath(out, record.path);
+            out.write("]\n");
+        }
+        else {
+            writeKeyPath(out, record.path);
+            out.write(" = ");
+            out.write(record.text);
+            out.put('\n');
+        }
+    }
+    out.flush();
+    if (out.error()) {
+        error = outputErrorMessage(out.error());
+        return false;
+    }
+    return true;
+}
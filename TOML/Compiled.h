@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// СКОМПИЛИРОВАННЫЙ ДОКУМЕНТ
+// Результат преобразования в двоичном виде для многократного чтения:
+// записи TOML-кода в порядке вывода (комментарии, заголовки таблиц и ключи
+// с полными путями через точку и значениями после разрешения ссылок $[...]),
+// упорядоченный по путям указатель ключей и пул строк без повторов.
+// Все ссылки в файле - смещения от начала разделов, поэтому файл
+// отображается в память и читается без разбора и копирования.
+//
+// Формат (числа в порядке байтов платформы, разделы выровнены на 8 байт):
+//   CompiledHeader
+//   CompiledRecord[recordCount]   - записи в порядке вывода
+//   uint32_t[keyCount]            - номера записей, упорядоченные по пути
+//   char[stringsSize]             - пул строк
+
+const uint32_t COMPILED_FORMAT_VERSION = 2;
+
+// Вид записи
+enum CompiledKind : uint8_t {
+    COMPILED_COMMENT = 0,   // Комментарий: text - тело
+    COMPILED_TABLE = 1,     // Заголовок таблицы: path - путь словаря
+    COMPILED_VALUE = 2      // Ключ: path - путь ключа, text - значение в TOML
+};
+
+// Тип значения ключа
+enum CompiledType : uint8_t {
+    COMPILED_NONE = 0,      // Не ключ
+    COMPILED_STRING = 1,    // Строка; text - в кавычках, как в TOML
+    COMPILED_INTEGER = 2,   // Целое int64
+    COMPILED_FLOAT = 3,     // Число double, включая inf и nan
+    COMPILED_BOOLEAN = 4    // true или false
+};
+
+struct CompiledHeader {
+    char magic[8];              // "TOMLBIN\0"
+    uint32_t byteOrder;         // 0x01020304 в порядке байтов записавшей платформы
+    uint32_t formatVersion;     // COMPILED_FORMAT_VERSION
+    uint32_t converterVersion;  // CONVERTER_VERSION преобразователя
+    uint32_t reserved;
+    uint64_t fileSize;
+    uint64_t recordsOffset;
+    uint64_t recordCount;
+    uint64_t keysOffset;
+    uint64_t keyCount;
+    uint64_t stringsOffset;
+    uint64_t stringsSize;
+};
+
+struct CompiledRecord {
+    uint8_t kind;           // CompiledKind
+    uint8_t type;           // CompiledType
+    uint16_t reserved;
+    uint32_t pathLength;
+    uint64_t path;          // Смещение пути в пуле строк
+    uint64_t text;          // Смещение текста в пуле строк
+    uint64_t textLength;
+    union {
+        int64_t integer;    // Значение COMPILED_INTEGER и COMPILED_BOOLEAN
+        double number;      // Значение COMPILED_FLOAT
+    };
+};
+
+// Запись, прочитанная из образа; строки указывают в отображённый файл
+struct CompiledEntry {
+    CompiledKind kind = COMPILED_COMMENT;
+    CompiledType type = COMPILED_NONE;
+    std::string_view path;
+    std::string_view text;
+    int64_t integer = 0;
+    double number = 0;
+
+    // Содержимое строки без кавычек
+    std::string_view string() const;
+};
+
+// Сборка образа при преобразовании
+class CompiledWriter {
+public:
+    CompiledWriter() = default;
+    CompiledWriter(const CompiledWriter&) = delete;
+    CompiledWriter& operator=(const CompiledWriter&) = delete;
+
+    // Пути задаются номерами путей преобразователя; полное имя пути
+    // передаётся один раз, до первой записи с этим путём
+    bool hasPath(uint32_t path) const;
+    void definePath(uint32_t path, std::string_view name);
+
+    void comment(std::string_view body);
+    void table(uint32_t path);
+    void value(uint32_t path, std::string_view toml);
+
+    // Образ в памяти, совпадающий с содержимым файла
+    void serialize(std::string& image) const;
+
+    // Запись образа в файл; false и сообщение в error при ошибке
+    bool write(const std::string& path, std::string& error);
+
+    void clear();
+
+private:
+    uint64_t intern(std::string_view text);
+    CompiledRecord& add(CompiledKind kind, uint32_t path);
+
+    // Строка пула; хеш и сравнение читают её из пула по смещению
+    struct PooledString {
+        uint64_t offset;
+        uint64_t length;
+    };
+    struct PoolHash {
+        const std::string* pool;
+        size_t operator()(const PooledString& s) const;
+    };
+    struct PoolEqual {
+        const std::string* pool;
+        bool operator()(const PooledString& a, const PooledString& b) const;
+    };
+
+    std::vector<CompiledRecord> records;
+    std::vector<PooledString> pathNames;    // Путь -> имя в пуле (length == UINT64_MAX - не задано)
+    std::vector<uint32_t> lastRecord;       // Путь -> последняя запись с ним
+    std::string strings;
+    std::unordered_set<PooledString, PoolHash, PoolEqual> pooled{ 0, PoolHash{ &strings }, PoolEqual{ &strings } };
+};
+
+// Образ, отображённый в память или загруженный из памяти
+class CompiledConfig {
+public:
+    CompiledConfig() = default;
+    ~CompiledConfig();
+
+    CompiledConfig(const CompiledConfig&) = delete;
+    CompiledConfig& operator=(const CompiledConfig&) = delete;
+
+    // Открытие проверяет только заголовок и границы разделов; записи
+    // проверяются при обращении. false и сообщение в error при ошибке.
+    bool open(const std::string& path, std::string& error);
+    // Образ из памяти (CompiledWriter::serialize); объект владеет им
+    bool load(std::string image, std::string& error);
+    void close();
+
+    size_t size() const;
+    CompiledEntry entry(size_t index) const;
+
+    // Поиск ключа или таблицы по полному пути через точку. Для ключа,
+    // которому значение присваивалось несколько раз, - последнее значение.
+    bool find(std::string_view path, CompiledEntry& entry) const;
+
+    // TOML-код документа, совпадающий с выводом преобразования.
+    // false и сообщение в error при ошибке записи.
+    bool writeToml(int fd, std::string& error) const;
+
+private:
+    bool attach(const std::string& path, std::string& error);
+    std::string_view pooled(uint64_t offset, uint64_t length) const;
+
+    std::string memory;                     // Образ, загруженный из памяти
+    const char* data = nullptr;
+    size_t dataSize = 0;
+    bool mapped = false;
+    const CompiledHeader* header = nullptr;
+    const CompiledRecord* records = nullptr;
+    const uint32_t* keys = nullptr;
+    const char* strings = nullptr;
+};
@@ -0,0 +1,3498 @@
+﻿#include <iostream>
+#include <vector>
+#include <fstream>
+#include <string>
+#include <locale>
+#include <map> 
+#include <stack>
+#include <cctype>
+#include <sstream>
+#include <algorithm>
+#include <deque>
+#include <string_view>
+#include <cstdint>
+#include <unordered_map>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include "Arena.h"
+#include "Compiled.h"
+#include "Converter.h"
+#include "Output.h"
+#include "Simd.h"
+#include "Unicode.h"
+
+using namespace std;
+
+// ЛЕКСИЧЕСКИЙ АНАЛИЗАТОР
+// Состояния автомата
+enum states {
+    H,     // Начальное состояние
+    ID,    // Идентификатор или ключевое слово
+    NUM,   // Число
+    STR,   // Строковый литерал
+    REF,   // Ссылка на константу
+    C1,    // Начало комментария
+    C2,    // Многострочный комментарий
+    C3,    // Однострочный комментарий
+    DLM,   // Ограничитель
+    ERR    // Ошибка
+};
+
+// Типы токенов
+enum TokenType {
+    KWORD = 1,      // Ключевые слова
+    IDENT = 2,      // Идентификаторы
+    NUMERIC = 3,    // Числа
+    DELIM = 4,      // Ограничители
+    COMMENTS = 5,   // Комментарий
+    STRING = 6,     // Строковый литерал
+    REFERENCE = 7,  // Ссылка на константу
+    LEXERROR = 8    // Ошибочная лексема: ошибка сообщается, когда до неё дойдёт разбор
+};
+
+// Виды лексических ошибок (индекс токена LEXERROR)
+enum LexicalError {
+    LE_UNEXPECTED = 0,  // Неожиданный символ
+    LE_RANGE = 1,       // Число не помещается в int64 или double
+    LE_ENCODING = 2     // Неверная последовательность UTF-8
+};
+
+// Структура токена.
+// Токен не хранит текст лексемы: он ссылается на неё смещением и длиной
+// во входных данных и занимает 16 байт без обращений к куче.
+struct Token {
+    uint64_t offset : 56;  // Смещение лексемы во входных данных
+    uint64_t type : 8;     // Тип токена (TokenType)
+    uint32_t length;       // Длина лексемы
+    int32_t index;         // Индекс токена в таблице
+};
+static_assert(sizeof(Token) == 16, "Token должен занимать 16 байт");
+
+// ПОТОКОВЫЙ ИСТОЧНИК ВХОДНЫХ ДАННЫХ
+// Вход читается порциями по мере надобности сканеру, поэтому объём памяти
+// не зависит от размера входного файла, а разбор идёт одновременно с чтением.
+const size_t CHUNK_SIZE = 64 * 1024;   // Размер порции, читаемой за один раз
+const size_t LOOKAHEAD_SIZE = 256;     // Размер окна предпросмотра токенов
+const size_t PARALLEL_CHUNK_MIN = 64 * 1024;    // Границы размера части при параллельном разборе
+const size_t PARALLEL_CHUNK_MAX = 1024 * 1024;
+
+// Ключевые слова
+constexpr string_view TW[] = { "set", "true", "false" };
+// Ограничители
+constexpr string_view TL[] = { "%{", "%}", "{", ":", ";", "}", "--", "$", "[", "]", "=", "\"" };
+
+// Классы символов сканера. Таблица строится при компиляции и не зависит
+// от локали: байты старше 0x7F не относятся ни к одному классу, символы
+// вне ASCII в идентификаторах проверяются по свойствам Unicode (Unicode.h).
+enum CharClass : uint8_t {
+    CC_SPACE = 1,   // Пробельный символ
+    CC_ALPHA = 2,   // Латинская буква
+    CC_DIGIT = 4,   // Десятичная цифра
+    CC_IDENT = 8,   // Продолжение идентификатора: буква, цифра или '_'
+    CC_DELIM = 16   // Односимвольный ограничитель из TL
+};
+
+constexpr array<uint8_t, 256> makeCharClasses() {
+    array<uint8_t, 256> classes{};
+    for (char c : string_view(" \t\n\v\f\r")) classes[(unsigned char)c] |= CC_SPACE;
+    for (int c = 'a'; c <= 'z'; c++) classes[c] |= CC_ALPHA | CC_IDENT;
+    for (int c = 'A'; c <= 'Z'; c++) classes[c] |= CC_ALPHA | CC_IDENT;
+    for (int c = '0'; c <= '9'; c++) classes[c] |= CC_DIGIT | CC_IDENT;
+    classes['_'] |= CC_IDENT;
+    for (string_view delim : TL) {
+        if (delim.size() == 1) classes[(unsigned char)delim[0]] |= CC_DELIM;
+    }
+    return classes;
+}
+constexpr array<uint8_t, 256> charClasses = makeCharClasses();
+
+// Принадлежность символа одному из классов cls
+inline bool hasClass(char c, uint8_t cls) {
+    return (charClasses[(unsigned char)c] & cls) != 0;
+}
+
+// Индексы односимвольных ограничителей в TL (-1, если символ не ограничитель)
+constexpr array<int8_t, 256> makeDelimiterIndex() {
+    array<int8_t, 256> index{};
+    for (auto& entry : index) entry = -1;
+    for (int i = 0; i < (int)size(TL); i++) {
+        if (TL[i].size() == 1) index[(unsigned char)TL[i][0]] = (int8_t)i;
+    }
+    return index;
+}
+constexpr array<int8_t, 256> delimiterIndex = makeDelimiterIndex();
+
+// Поиск ключевого слова. Длины слов в TW различны, поэтому длина
+// служит совершенной хеш-функцией и достаточно одного сравнения.
+constexpr int findKeyword(string_view word) {
+    int index = (word.size() >= 3 && word.size() <= 5) ? (int)word.size() - 3 : -1;
+    return (index != -1 && TW[index] == word) ? index : -1;
+}
+
+// Поиск ограничителя: односимвольные - по таблице, двухсимвольные - по первому символу
+constexpr int findDelimiter(string_view delim) {
+    if (delim.size() == 1) return delimiterIndex[(unsigned char)delim[0]];
+    if (delim.size() != 2) return -1;
+    switch (delim[0]) {
+    case '%':
+        if (delim[1] == '{') return 0;
+        if (delim[1] == '}') return 1;
+        return -1;
+    case '-':
+        return delim[1] == '-' ? 6 : -1;
+    default:
+        return -1;
+    }
+}
+
+// Проверка таблиц при компиляции
+constexpr bool checkLexerTables() {
+    for (int i = 0; i < (int)size(TW); i++) {
+        if (findKeyword(TW[i]) != i) return false;
+    }
+    for (int i = 0; i < (int)size(TL); i++) {
+        if (findDelimiter(TL[i]) != i) return false;
+    }
+    return findKeyword("sex") == -1 && findDelimiter("%%") == -1 && findDelimiter("a") == -1;
+}
+static_assert(checkLexerTables(), "Таблицы TW/TL не согласованы с функциями поиска");
+
+// Индексы многосимвольных ограничителей
+constexpr int DL_COMMENT_OPEN = findDelimiter("%{");
+constexpr int DL_COMMENT_CLOSE = findDelimiter("%}");
+constexpr int DL_LINE_COMMENT = findDelimiter("--");
+constexpr int DL_COLON = findDelimiter(":");
+constexpr int DL_ASSIGN = findDelimiter("=");
+
+// Цифра системы счисления base (2, 8, 10 или 16)
+inline bool isDigitOf(char c, int base) {
+    switch (base) {
+    case 2: return c == '0' || c == '1';
+    case 8: return c >= '0' && c <= '7';
+    case 16: return hasClass(c, CC_DIGIT) || (c >= 'a' && c <= 'f') || (c >= 'A' && c <= 'F');
+    default: return hasClass(c, CC_DIGIT);
+    }
+}
+
+// Таблица интернирования: одна запись на каждое различное имя.
+// Номер записи (атом) переносится в токен и далее в AST, поэтому
+// последующие стадии сравнивают имена как целые числа.
+struct AtomTable {
+    deque<string> names;                    // Различные имена в порядке появления
+    unordered_map<string_view, int> ids;    // Имя -> атом (ключи ссылаются на names)
+
+    int intern(string_view name) {
+        auto it = ids.find(name);
+        if (it != ids.end()) return it->second;
+        int atom = names.size();
+        names.emplace_back(name);
+        ids.emplace(names.back(), atom);
+        return atom;
+    }
+
+    const string& name(int atom) const {
+        return names[atom];
+    }
+
+    // Очистка таблицы перед новым преобразованием
+    void clear() {
+        names.clear();
+        ids.clear();
+    }
+};
+
+// Названия типов токенов (индекс - TokenType)
+constexpr string_view tokenTypeNames[] = {
+    "", "KWORD", "IDENT", "NUMERIC", "DELIM", "COMMENTS", "STRING", "REFERENCE", "LEXERROR"
+};
+
+// СИНТАКСИЧЕСКИЙ АНАЛИЗАТОР
+// Виды узлов AST
+enum NodeKind : uint8_t {
+    N_COMMENT,       // Комментарий
+    N_MULTILINE,     // Тело многострочного комментария
+    N_SINGLE_LINE,   // Тело однострочного комментария
+    N_DICTIONARY,    // Словарь
+    N_KEY,           // Ключ словаря
+    N_STRING,        // Строковое значение
+    N_NUMBER,        // Числовое значение
+    N_BOOLEAN,       // Логическое значение
+    N_REFERENCE,     // Ссылка на константу
+    N_TRANSLATION,   // Объявление константы set
+    N_ASSIGNMENT,    // Присваивание
+    N_IDENTIFIER     // Имя константы или переменной
+};
+
+const char* const nodeKindNames[] = {
+    "Comment", "multiline", "single-line", "Dictionary", "Key", "String",
+    "Number", "Boolean", "Reference", "Translation", "Assignment", "Identifier"
+};
+
+// Структура узла AST.
+// Узлы размещаются в арене и освобождаются все сразу. Значение узла не
+// копируется: имена и числа задаются атомом, строки и комментарии -
+// смещением и длиной во входных данных.
+class ASTNode {
+public:
+    NodeKind kind;
+    int atom;         // Атом имени (TI), числа (TN) или индекс ключевого слова (TW)
+    uint64_t offset;  // Начало значения во входных данных
+    uint32_t length;  // Длина значения
+    ASTNode* left;    // Левый потомок
+    ASTNode* right;   // Правый потомок
+    ASTNode* next;    // Следующий ключ того же словаря
+
+    ASTNode(NodeKind kind, int atom = -1, uint64_t offset = 0, uint32_t length = 0)
+        : kind(kind), atom(atom), offset(offset), length(length), left(nullptr), right(nullptr), next(nullptr) {}
+};
+
+// Кадр разбора словаря: словарь и его последний ключ
+struct ParseFrame {
+    ASTNode* dictionary;
+    ASTNode* last;
+};
+
+// СЕМАНТИЧЕСКИЙ АНАЛИЗАТОР
+// Значение константы: TOML-код скаляра или словарь с ключами в порядке
+// объявления. После построения не изменяется, поэтому ссылки $[...]
+// разделяют его без копирования, а словарь разворачивается в таблицы
+// только при выводе.
+struct ConstantValue {
+    // Пустой словарь
+    ConstantValue() : dictionary(true) {}
+    // Скаляр
+    explicit ConstantValue(string text) : text(move(text)) {}
+
+    bool dictionary = false;
+    string text;                                                // TOML-код скаляра
+    vector<pair<int, shared_ptr<const ConstantValue>>> keys;    // Атом имени и значение ключа словаря
+};
+using ConstantRef = shared_ptr<const ConstantValue>;
+
+// Отметки вида символа без собственного значения: константа-словарь
+// до окончания анализа и переменная, объявленная присваиванием
+static const ConstantRef constMarker = make_shared<const ConstantValue>("const");
+static const ConstantRef varMarker = make_shared<const ConstantValue>("var");
+static const ConstantRef emptyValue = make_shared<const ConstantValue>("");
+
+// Запись символа таблицы: объявлен ли путь и его значение
+struct Symbol {
+    bool declared = false;
+    ConstantRef value;  // Отметка вида или значение для ссылок $[...]
+};
+
+// Кадр обхода словаря: следующий ключ, путь словаря и, если словарь
+// - значение константы, собираемое значение
+struct DictionaryFrame {
+    ASTNode* key;
+    int path;
+    ConstantValue* constant = nullptr;
+};
+
+// Кадр вывода словаря-константы: следующий ключ и путь словаря
+struct ConstantFrame {
+    const ConstantValue* dictionary;
+    size_t next;
+    int path;
+};
+
+// Состояние генератора TOML: вывод и текущий путь словаря в виде стека
+// атомов имён. У каждого потока семантического анализа - своё.
+struct Emitter {
+    explicit Emitter(OutputBuffer& out) : out(out) {}
+
+    OutputBuffer& out;
+    CompiledWriter* compiled = nullptr;    // Сборка образа документа (nullptr - не собирается)
+    vector<int> pathStack;
+    vector<DictionaryFrame> dictionaryFrames;  // Стек обхода, используется повторно
+    vector<ConstantFrame> constantFrames;      // Стек вывода словарей-констант
+};
+
+// Поток семантического анализа: свой буфер вывода и свой генератор
+struct AnalysisWorker {
+    OutputBuffer out{ -1, 64 * 1024 };
+    Emitter emitter{ out };
+};
+
+// Потоки параллельного семантического анализа. Создаются при первом пакете
+// и ждут следующих пакетов до уничтожения конвейера, поэтому пакет каждой
+// части входа не создаёт потоки заново.
+class AnalysisPool {
+public:
+    AnalysisPool() = default;
+    AnalysisPool(const AnalysisPool&) = delete;
+    AnalysisPool& operator=(const AnalysisPool&) = delete;
+
+    ~AnalysisPool() {
+        {
+            lock_guard<mutex> lock(guard);
+            stopping = true;
+        }
+        started.notify_all();
+        for (thread& t : threads) t.join();
+    }
+
+    // Выполнение job(t) для t = 1..count-1 в потоках пула и для t = 0
+    // в вызывающем потоке. Возврат - после завершения всех вызовов;
+    // исключение job(0) передаётся дальше тоже только после этого.
+    template <class Job>
+    void run(unsigned count, Job& job) {
+        {
+            lock_guard<mutex> lock(guard);
+            while (threads.size() + 1 < count) {
+                unsigned index = (unsigned)threads.size() + 1;
+                threads.emplace_back([this, index] { serve(index); });
+            }
+            context = &job;
+            call = [](void* context, unsigned index) { (*static_cast<Job*>(context))(index); };
+            participants = count;
+            running = count - 1;
+            generation++;
+        }
+        started.notify_all();
+        exception_ptr error;
+        try {
+            job(0);
+        }
+        catch (...) {
+            error = current_exception();
+        }
+        unique_lock<mutex> lock(guard);
+        finished.wait(lock, [&] { return running == 0; });
+        if (error) rethrow_exception(error);
+    }
+
+private:
+    // Поток index выполняет задания пакетов, в которых он участвует.
+    // Задание не выпускает исключений: ошибки оно сохраняет само.
+    void serve(unsigned index) {
+        uint64_t seen = 0;
+        unique_lock<mutex> lock(guard);
+        while (true) {
+            started.wait(lock, [&] { return stopping || generation != seen; });
+            if (stopping) return;
+            seen = generation;
+            if (index >= participants) continue;
+            lock.unlock();
+            call(context, index);
+            lock.lock();
+            if (--running == 0) finished.notify_all();
+        }
+    }
+
+    mutex guard;
+    condition_variable started;
+    condition_variable finished;
+    vector<thread> threads;
+    void* context = nullptr;
+    void (*call)(void*, unsigned) = nullptr;
+    uint64_t generation = 0;        // Номер текущего пакета
+    unsigned participants = 0;      // Потоки пакета, включая вызывающий
+    unsigned running = 0;           // Потоки пула, ещё выполняющие пакет
+    bool stopping = false;
+};
+
+// ИНКРЕМЕНТАЛЬНОЕ ПРЕОБРАЗОВАНИЕ
+// Оператор верхнего уровня преобразованного документа. Начало оператора
+// в тексте - конец предыдущего, конец TOML-кода - начало TOML-кода следующего.
+struct DocumentStatement {
+    size_t end;         // Конец последней лексемы оператора в тексте
+    size_t output;      // Начало TOML-кода оператора
+    uint32_t roots;     // Начало корневых путей оператора в documentRoots
+    uint32_t written;   // Число объявляемых корневых путей; за ними идут читаемые
+};
+
+// ЗАПРОС ЗНАЧЕНИЙ
+// Оператор верхнего уровня, найденный без разбора
+struct QueryStatement {
+    size_t begin;       // Конец предыдущего оператора
+    size_t end;
+    bool assignment;    // Присваивание "имя = $[...]"
+    bool constant;      // Объявление "set имя = ..."
+};
+
+// Значение корневого имени, заданное оператором statement: set или
+// присваивание (position 0) либо ключ верхнего уровня словаря со скалярным
+// значением (position - номер ключа). Ссылка из ключа словаря видит ключи
+// с меньшими номерами, ссылка из set и присваивания - их собственное имя.
+struct QueryDefinition {
+    uint32_t statement;
+    uint32_t position;
+};
+
+static bool operator<(const QueryDefinition& a, const QueryDefinition& b) {
+    return a.statement != b.statement ? a.statement < b.statement : a.position < b.position;
+}
+
+// Ссылка $[atom] из оператора statement; position - как у QueryDefinition
+struct QueryReference {
+    int atom;
+    uint32_t statement;
+    uint32_t position;
+};
+
+// Кадр поиска пути: узел, число пройденных сегментов и номер ключа
+// верхнего уровня, в котором лежит узел
+struct QuerySearchFrame {
+    ASTNode* node;
+    size_t depth;
+    uint32_t position;
+};
+
+// Отметки корневых путей при обновлении документа
+enum RootFlags : uint8_t {
+    ROOT_CHANGED = 1,   // Объявления пути могли измениться
+    ROOT_REBUILT = 2    // Символы пути очищены и восстанавливаются заново
+};
+
+// Ошибка преобразования. Прерывает разбор и возвращается вызывающему
+// в ConversionResult::diagnostic; what() - полный текст сообщения.
+class ConversionError : public runtime_error {
+public:
+    explicit ConversionError(const string& message) : runtime_error(message) {}
+};
+
+// Синтаксическая ошибка. Текст и индекс хранятся отдельно: при разборе
+// по частям номер строки становится известен только после анализа
+// предыдущих частей.
+class SyntaxError : public ConversionError {
+public:
+    SyntaxError(const string& message, int line, int index)
+        : ConversionError("Синтаксическая ошибка: " + message + " в строке " + to_string(line) + " по индексу " + to_string(index)),
+          message(message), index(index) {}
+
+    string message;
+    int index;
+};
+
+// Таймер этапа для статистики; выключенный не обращается к часам
+class StageTimer {
+public:
+    explicit StageTimer(bool enabled) {
+        if (enabled) start = chrono::steady_clock::now();
+    }
+
+    double seconds() const {
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    chrono::steady_clock::time_point start;
+};
+
+// КОНВЕЙЕР ПРЕОБРАЗОВАНИЯ
+// Всё состояние одного преобразования: окно входа, окно предпросмотра,
+// таблицы, арена AST, таблица символов и буфер вывода. Буферы сохраняются
+// между преобразованиями и только очищаются в reset().
+class Pipeline {
+public:
+    explicit Pipeline(const ConverterOptions& options) : options(options) {}
+
+    ConverterOptions options;
+
+    // Подготовка к новому преобразованию потока или текста в памяти
+    void reset(istream& in);
+    void reset(string_view text);
+
+    // Полный разбор входа с выводом TOML-кода в tomlOutput
+    void run();
+
+    // Обновление документа до новой версии текста
+    void update(string_view text);
+    void dropDocument();
+
+    string documentToml;                // TOML-код последней успешной версии документа
+    DocumentChange documentChange;      // Изменение TOML-кода при последнем обновлении
+
+    // Буфер сгенерированного TOML-кода
+    OutputBuffer tomlOutput;
+
+    ConversionStage stage = ConversionStage::Analyze;  // Последний выполняемый этап
+    ConversionCounters counters;
+
+    // Статистика (Converter::stats). Обращения к символам считаются
+    // атомарно: их выполняют и потоки параллельного анализа.
+    bool collectStats = false;
+    double scannerSeconds = 0;
+    double parserSeconds = 0;
+    double semanticSeconds = 0;
+    double totalSeconds = 0;
+    OutputStats outputStats;
+    array<size_t, size(tokenTypeNames)> tokenTypeCounts = {};
+    array<size_t, size(nodeKindNames)> nodeKindCounts = {};
+    atomic<size_t> symbolLookups{ 0 };
+    atomic<size_t> constantLookups{ 0 };
+    size_t inputSize() const {
+        return inputBase + input.size();
+    }
+    size_t symbolCount() const {
+        return globalSymbols.size();
+    }
+    size_t pathCount() const {
+        return paths.size();
+    }
+
+    // Значения ключей по путям без преобразования всего текста
+    void query(string_view text, const vector<string>& keys, vector<QueryValue>& values);
+
+    // Сборка образа документа при преобразовании (nullptr - не собирается)
+    void compileTo(CompiledWriter* writer) {
+        tomlEmitter.compiled = writer;
+    }
+
+private:
+    istream* inputStream = nullptr; // Источник входных данных
+    string window;                  // Прочитанная из потока часть входа
+    string_view input;              // Окно ещё не разобранных входных данных
+    size_t inputBase = 0;           // Позиция начала окна во всём входе
+    size_t pos = 0;                 // Текущая позиция сканера в окне
+    size_t lexemeStart = 0;         // Начало текущей лексемы во всём входе
+    size_t retainFrom = SIZE_MAX;   // Начало разбираемого оператора, на который ссылается AST
+    bool inputEnded = false;        // Вход прочитан до конца
+
+    // Окно предпросмотра: токены, уже выделенные сканером, но ещё не разобранные
+    deque<Token> tokens;
+    bool scannerDone = false;       // Сканер выдал завершающий токен "end"
+
+    // Таблицы идентификаторов и чисел. Тела комментариев не копируются:
+    // они читаются из окна входа, как строки.
+    // Числа интернируются в каноническом виде TOML (formatNumber), поэтому
+    // 0x10, 1_6 и 16 - один атом TN
+    AtomTable TI;
+    AtomTable TN;
+    string numberText;              // Цифры числа без '_', используется повторно
+    int previousDelimiter = -1;     // Ограничитель последнего токена (-1 - другой токен)
+    LexicalError lexicalError = LE_UNEXPECTED;
+
+    int commentCount = 0;           // Номер следующего комментария (индекс токена COMMENTS)
+    int lineIndex = 1;
+    int currentIndex = 0;
+
+    // Арена узлов AST текущего оператора
+    Arena arena;
+    vector<ParseFrame> parseFrames;  // Стек разбора, используется повторно
+
+    // Таблица путей ключей. Путь "a.b.c" хранится как цепочка пар
+    // (родительский путь, атом имени); путь 0 - корень.
+    vector<pair<int, int>> paths = { { -1, -1 } };
+    unordered_map<uint64_t, int> pathIds;
+
+    // Глобальная таблица символов для хранения всех ключей (индекс - номер пути)
+    vector<Symbol> globalSymbols;
+
+    Emitter tomlEmitter{ tomlOutput };  // Генератор, пишущий в tomlOutput
+
+    // Разбор по частям: разобранные операторы части сохраняются
+    // и анализируются позже главным конвейером в порядке входа
+    bool collecting = false;            // Операторы сохраняются, а не анализируются
+    vector<ASTNode*> statements;        // Разобранные операторы части
+    vector<ASTNode*> atomNodes;         // Узлы части с атомами TI и TN
+    bool stopped = false;               // Разбор части остановлен идентификатором end
+    exception_ptr chunkError;           // Ошибка, прервавшая разбор части
+    vector<unique_ptr<Pipeline>> chunkParsers;  // Конвейеры разбора частей
+    vector<int> identMap;               // Атом TI части -> атом TI конвейера
+    vector<int> numberMap;              // Атом TN части -> атом TN конвейера
+
+    // Параллельный семантический анализ операторов пакета
+    vector<int> writtenPaths;           // Корневые пути, которые оператор объявляет
+    vector<int> readPaths;              // Корневые пути констант, на которые он ссылается
+    vector<int> lastWriter;             // Путь -> последний объявивший его оператор пакета
+    vector<int> lastReader;             // Путь -> последняя запись о чтении в readRecords
+    vector<pair<int, int>> readRecords; // Чтение после объявления: (оператор, предыдущая запись)
+    vector<int> batchPaths;             // Корневые пути, которых касается пакет
+    vector<DictionaryFrame> collectFrames;  // Стек обхода словарей при сборе путей
+    vector<int> waiting;                // Число незавершённых предшественников оператора
+    vector<vector<int>> successors;     // Операторы, ожидающие завершения оператора
+    vector<string> statementOutput;     // TOML-код каждого оператора пакета
+    vector<exception_ptr> statementErrors;  // Ошибки операторов пакета
+    vector<unique_ptr<AnalysisWorker>> analysisWorkers;
+    AnalysisPool analysisPool;          // Уничтожается раньше analysisWorkers
+
+    // Инкрементальное преобразование документа
+    bool documentReady = false;         // Документ преобразован и может обновляться
+    string documentText;                // Текст последней успешной версии
+    string updateText;                  // Новый текст, если к нему добавлен перевод строки
+    string nextToml;                    // TOML-код обновляемой версии от первого изменённого оператора
+    vector<DocumentStatement> documentStatements;
+    vector<int> documentRoots;          // Корневые пути операторов подряд
+    vector<DocumentStatement> insertedStatements;  // Операторы, разобранные заново
+    vector<int> insertedRoots;
+    vector<uint8_t> tailAffected;       // Прежний оператор после разобранных анализируется заново
+    vector<size_t> tailOutput;          // Новое начало TOML-кода прежних операторов
+    vector<uint8_t> rootFlags;          // Корневой путь -> RootFlags
+    vector<int> markedRoots;            // Отмеченные корневые пути
+    vector<pair<int, Symbol>> savedSymbols;  // Очищенные символы для отката при ошибке
+    vector<int> pathRoots;              // Путь -> его корневой путь
+    vector<int> subtreeNext;            // Следующий путь поддерева того же корневого пути
+    size_t builtPaths = 0;              // Число путей после полного преобразования
+    bool replaying = false;             // Анализируются только пути с ROOT_REBUILT
+    size_t consumedEnd = 0;             // Конец последней разобранной лексемы
+    AnalysisWorker documentWorker;
+
+    // Лексический анализатор
+    bool fillInput();
+    bool available(size_t ahead = 0);
+    string_view tokenText(const Token& token);
+    void addToken(TokenType type, size_t start, size_t end, int index = 0);
+    bool scanNumber();
+    size_t identifierChar(bool start);
+    bool validText(size_t from);
+    bool scanner();
+    void printToken(const Token& token);
+
+    // Синтаксический анализатор
+    string_view nodeValue(const ASTNode* node);
+    void printNode(ASTNode* node, int depth);
+    const Token& currentToken();
+    string_view currentValue();
+    void nextToken();
+    [[noreturn]] void error(string message);
+    void match(TokenType expectedType, string_view expectedValue = "");
+    ASTNode* makeNode(NodeKind kind, int atom = -1);
+    ASTNode* makeTokenNode(NodeKind kind);
+    void S();
+    ASTNode* Statement();
+    ASTNode* Comment();
+    ASTNode* Dictionary();
+    ASTNode* Value();
+    ASTNode* Reference();
+    ASTNode* Translation();
+    ASTNode* Assignment();
+
+    // Семантический анализатор и генерация TOML
+    int pathOf(int parent, int atom);
+    string pathName(int path);
+    string emittedPath(Emitter& emitter, int atom = -1);
+    int compiledPath(Emitter& emitter, int path, int atom = -1);
+    Symbol& symbolOf(int path);
+    [[noreturn]] void semanticError(string message);
+    void declareVariable(int path, string varType);
+    string lookupVariable(int path);
+    const ConstantRef& getConstantValue(int atom);
+    void writeName(Emitter& emitter, int atom);
+    void writePath(Emitter& emitter);
+    void writeTableHeader(Emitter& emitter, int path);
+    void writeKey(Emitter& emitter, int atom);
+    void writeValue(Emitter& emitter, ASTNode* value, const ConstantValue* referenced);
+    void writeDictionary(Emitter& emitter, const ConstantValue& dictionary, int path);
+    ConstantRef constantOf(ASTNode* value);
+    void writeComment(Emitter& emitter, string_view text);
+    void analyzeDictionary(Emitter& emitter, ASTNode* dictionary, int path, ConstantValue* constant = nullptr);
+    void semanticAnalysis(Emitter& emitter, ASTNode* node);
+    bool replayed(int root) const;
+
+    // Преобразование
+    void resetScanner();
+    void resetParser();
+    void resetSemantics();
+    void parseChunk(string_view text, size_t begin, size_t end, bool first);
+    bool analyzeChunk(Pipeline& chunk);
+    void runParallel();
+    void collectPaths(ASTNode* statement);
+    void analyzeStatements(const vector<ASTNode*>& batch);
+
+    // Инкрементальное преобразование
+    void scanRange(string_view text, size_t begin, size_t end);
+    void indexPaths();
+    void rebuildRoot(int root);
+    void markChanged(int root);
+    void restoreSymbols();
+    void analyzeRange(string_view text, size_t begin, size_t end, bool replay);
+
+    // Запрос значений
+    string_view queryText;
+    string queryStorage;    // Текст с добавленным концом строки; window очищается при разборе
+    vector<QueryStatement> queryStatements;
+    unordered_map<string_view, vector<uint32_t>> queryRoots;  // Корневое имя -> объявляющие его операторы
+    unordered_map<string_view, vector<QueryDefinition>> queryDefinitions;  // Корневое имя -> его значения
+    unordered_map<uint64_t, ConstantRef> queryConstants;      // (оператор, атом имени) -> значение константы
+    vector<QueryReference> queryWork;                          // Ссылки для разрешения
+    vector<QueryReference> queryPending;                       // Вычисляемые константы: атом и определение
+    vector<ASTNode*> queryNodes;
+    vector<DictionaryFrame> queryFrames;
+    vector<QuerySearchFrame> querySearch;
+    vector<pair<const ConstantRef*, size_t>> constantSearch;
+    vector<bool> queryChecked;      // Операторы, проверяемые семантическим анализом
+    vector<bool> queryCheckedRoots; // Корневые пути, добавленные в queryCheckRoots
+    vector<int> queryCheckRoots;    // Корневые пути, объявляющие операторы которых проверяются
+    AnalysisWorker queryWorker;     // Вывод проверки отбрасывается
+
+    void indexStatements(string_view text);
+    ASTNode* parseStatement(uint32_t index);
+    void checkStatements(const vector<string>& keys);
+    ASTNode* rootValue(ASTNode* statement, int atom, uint32_t position);
+    ConstantRef findValue(ASTNode* statement, const vector<int>& path, uint32_t index, bool collect);
+    ConstantRef findInConstant(const ConstantRef& value, const vector<int>& path, size_t depth);
+    const QueryDefinition* constantDefinition(int atom, uint32_t statement, uint32_t position);
+    void collectReferences(ASTNode* value, uint32_t statement, uint32_t position);
+    void resolveConstants();
+    const ConstantRef& resolvedConstant(int atom, uint32_t statement, uint32_t position);
+    ConstantRef queryScalar(ASTNode* value, uint32_t statement, uint32_t position);
+    ConstantRef queryValueOf(ASTNode* value, uint32_t statement, uint32_t position);
+};
+
+// Дочитывание следующей порции входа в окно.
+// Отбрасывается только та часть окна, на которую уже не ссылается
+// ни один токен из окна предпросмотра и ни текущая лексема.
+bool Pipeline::fillInput() {
+    if (inputEnded) return false;
+
+    size_t keep = min(lexemeStart, retainFrom);
+    if (!tokens.empty() && tokens.front().offset < keep) keep = tokens.front().offset;
+    size_t drop = keep - inputBase;
+    window.erase(0, drop);
+    inputBase += drop;
+    pos -= drop;
+
+    size_t before = window.size();
+    string line;
+    while (window.size() - before < CHUNK_SIZE) {
+        if (!getline(*inputStream, line) || line == "exit") {
+            inputEnded = true;
+            break;
+        }
+        window += line;
+        window += '\n';
+    }
+    input = window;
+    return window.size() > before;
+}
+
+// Проверка наличия символа на позиции pos + ahead с дочитыванием входа
+bool Pipeline::available(size_t ahead) {
+    while (pos + ahead >= input.size()) {
+        if (!fillInput()) return false;
+    }
+    return true;
+}
+
+// Текст лексемы токена. Действителен до следующего дочитывания входа.
+string_view Pipeline::tokenText(const Token& token) {
+    if (token.type == IDENT && token.length == 0) return "end"; // Завершающий токен
+    return string_view(input.data() + (token.offset - inputBase), token.length);
+}
+
+// Добавление токена в окно предпросмотра.
+// start и end - абсолютные границы лексемы во входных данных.
+void Pipeline::addToken(TokenType type, size_t start, size_t end, int index) {
+    Token token;
+    token.offset = start;
+    token.type = type;
+    token.length = (uint32_t)(end - start);
+    token.index = index;
+    tokens.push_back(token);
+    previousDelimiter = type == DELIM ? index : -1;
+    counters.tokens++;
+    tokenTypeCounts[type]++;
+    if (options.tokenDump) printToken(token);
+}
+
+// Канонический TOML-код числа: целое - в десятичной записи, дробное -
+// кратчайшая запись, однозначно восстанавливающая значение double,
+// с ".0", если в ней нет ни точки, ни порядка
+static string_view formatInteger(char (&buffer)[32], int64_t value) {
+    to_chars_result written = to_chars(buffer, buffer + sizeof(buffer), value);
+    return string_view(buffer, written.ptr - buffer);
+}
+
+static string_view formatFloat(char (&buffer)[32], double value) {
+    if (isnan(value)) return signbit(value) ? "-nan" : "nan";
+    if (isinf(value)) return value < 0 ? "-inf" : "inf";
+    to_chars_result written = to_chars(buffer, buffer + sizeof(buffer) - 2, value);
+    char* end = written.ptr;
+    if (!memchr(buffer, '.', end - buffer) && !memchr(buffer, 'e', end - buffer)) {
+        *end++ = '.';
+        *end++ = '0';
+    }
+    return string_view(buffer, end - buffer);
+}
+
+// Десятичный порядок старшей значащей цифры записи [-]цифры[.цифры][e[+-]цифры]
+// (для 0.05 - -2, для 12e3 - 4). Порядок после 'e' ограничивается, чтобы
+// сумма не переполнялась.
+static int64_t decimalExponent(string_view text) {
+    size_t end = min(text.find('e'), text.size());
+    size_t point = min(text.find('.'), end);
+    int64_t lead = 0;
+    for (size_t k = text[0] == '-' ? 1 : 0; k < end; k++) {
+        if (text[k] == '.' || text[k] == '0') continue;
+        lead = k < point ? (int64_t)(point - k) - 1 : -(int64_t)(k - point);
+        break;
+    }
+    int64_t exponent = 0;
+    bool negative = end + 1 < text.size() && text[end + 1] == '-';
+    for (size_t k = end + 1; k < text.size(); k++) {
+        if (text[k] >= '0' && text[k] <= '9' && exponent < 1000000000) exponent = exponent * 10 + (text[k] - '0');
+    }
+    return lead + (negative ? -exponent : exponent);
+}
+
+// Числовой литерал от lexemeStart: [+-] десятичное целое или дробное
+// с порядком, 0x/0o/0b без знака, [+-]inf и [+-]nan. Между цифрами
+// допускается одиночный '_'. Значение проверяется на диапазон int64 или
+// double и интернируется в TN в каноническом виде. Дробное число, слишком
+// малое для double, округляется к нулю того же знака. При ошибке pos
+// указывает на ошибочный символ, а вид ошибки - в lexicalError.
+bool Pipeline::scanNumber() {
+    pos = lexemeStart - inputBase;
+    numberText.clear();
+    char sign = input[pos];
+    bool hasSign = sign == '+' || sign == '-';
+    if (hasSign) {
+        if (sign == '-') numberText += '-';
+        pos++;
+    }
+
+    // Цифры с одиночными '_' между ними; в numberText попадают только цифры
+    auto digits = [&](int base) {
+        size_t count = 0;
+        while (available()) {
+            char c = input[pos];
+            if (c == '_' && count > 0) {
+                if (!available(1) || !isDigitOf(input[pos + 1], base)) return false;
+                pos++;
+                continue;
+            }
+            if (!isDigitOf(c, base)) break;
+            numberText += c;
+            count++;
+            pos++;
+        }
+        return count > 0;
+    };
+
+    char buffer[32];
+    string_view canonical;
+    if (available() && (input[pos] == 'i' || input[pos] == 'n')) {
+        size_t wordStart = inputBase + pos;
+        while (available() && hasClass(input[pos], CC_IDENT)) pos++;
+        string_view word(input.data() + (wordStart - inputBase), inputBase + pos - wordStart);
+        if (word != "inf" && word != "nan") {
+            pos = wordStart - inputBase;
+            return false;
+        }
+        if (word == "nan") canonical = sign == '-' ? "-nan" : "nan";
+        else canonical = sign == '-' ? "-inf" : "inf";
+    }
+    else {
+        int base = 10;
+        if (!hasSign && available(1) && input[pos] == '0' && (input[pos + 1] == 'x' || input[pos + 1] == 'o' || input[pos + 1] == 'b')) {
+            base = input[pos + 1] == 'x' ? 16 : input[pos + 1] == 'o' ? 8 : 2;
+            pos += 2;
+        }
+        if (!digits(base)) return false;
+
+        bool real = false;
+        if (base == 10 && available() && input[pos] == '.') {
+            numberText += '.';
+            pos++;
+            if (!digits(10)) return false;
+            real = true;
+        }
+        if (base == 10 && available() && (input[pos] == 'e' || input[pos] == 'E')) {
+            numberText += 'e';
+            pos++;
+            if (available() && (input[pos] == '+' || input[pos] == '-')) {
+                numberText += input[pos];
+                pos++;
+            }
+            if (!digits(10)) return false;
+            real = true;
+        }
+
+        const char* first = numberText.data();
+        const char* last = first + numberText.size();
+        from_chars_result parsed;
+        if (real) {
+            double value = 0;
+            parsed = from_chars(first, last, value);
+            // from_chars сообщает о выходе за диапазон и тогда, когда значение
+            // округляется к нулю; ошибка - только переполнение
+            if (parsed.ec == errc::result_out_of_range && parsed.ptr == last && decimalExponent(numberText) < 0) {
+                value = sign == '-' ? -0.0 : 0.0;
+                parsed.ec = errc();
+            }
+            if (parsed.ec == errc()) canonical = formatFloat(buffer, value);
+        }
+        else {
+            int64_t value = 0;
+            parsed = from_chars(first, last, value, base);
+            if (parsed.ec == errc()) canonical = formatInteger(buffer, value);
+        }
+        if (parsed.ec != errc() || parsed.ptr != last) {
+            // Переполнение int64 или выход за диапазон double
+            lexicalError = LE_RANGE;
+            pos = lexemeStart - inputBase;
+            return false;
+        }
+    }
+    addToken(NUMERIC, lexemeStart, inputBase + pos, TN.intern(canonical));
+    return true;
+}
+
+// Длина символа вне ASCII на позиции pos, если он может начинать (start)
+// или продолжать идентификатор; иначе 0. Неверная последовательность
+// UTF-8 отмечается в lexicalError.
+size_t Pipeline::identifierChar(bool start) {
+    char32_t cp;
+    size_t length = decodeUtf8(input.data() + pos, input.data() + input.size(), cp);
+    if (length == 0) {
+        lexicalError = LE_ENCODING;
+        return 0;
+    }
+    return (start ? isXidStart(cp) : isXidContinue(cp)) ? length : 0;
+}
+
+// Проверка UTF-8 в части входа от абсолютной позиции from до pos.
+// При ошибке pos указывает на первый неверный байт.
+bool Pipeline::validText(size_t from) {
+    const char* begin = input.data() + (from - inputBase);
+    const char* end = input.data() + pos;
+    const char* bad = validateUtf8(begin, end);
+    if (bad == end) return true;
+    pos = bad - input.data();
+    lexicalError = LE_ENCODING;
+    return false;
+}
+
+// Лексический анализатор с конечным автоматом.
+// За один вызов выделяет очередную лексему (комментарий даёт несколько токенов)
+// и возвращает false, когда вход исчерпан и выдан завершающий токен.
+bool Pipeline::scanner() {
+    if (scannerDone) return false;
+
+    enum states CS = H; // Текущее состояние
+    lexemeStart = inputBase + pos;
+
+    while (true) {
+        char c = '\0';
+        if (available()) c = input[pos];
+
+        switch (CS) {
+        case H: { // Начальное состояние
+            while (available() && hasClass(c, CC_SPACE)) {
+                pos++;
+                if (available()) c = input[pos];
+            }
+            lexemeStart = inputBase + pos;
+            if (!available()) {
+                addToken(IDENT, lexemeStart, lexemeStart);
+                scannerDone = true;
+                return false;
+            }
+            if (hasClass(c, CC_ALPHA)) {
+                CS = ID;
+            }
+            else if ((unsigned char)c >= 0x80) {
+                // Идентификатор с буквы вне ASCII; неверный UTF-8 сообщается
+                // на позиции ошибочного байта
+                size_t length = identifierChar(true);
+                if (length != 0) {
+                    CS = ID;
+                    pos += length;
+                    break;
+                }
+                CS = ERR;
+                if (lexicalError == LE_ENCODING) break;
+            }
+            else if (hasClass(c, CC_DIGIT)) {
+                CS = NUM;
+            }
+            else if (c == '%' || c == '-') {
+                CS = C1;
+            }
+            else if (c == '+') {
+                CS = NUM;
+            }
+            else if (c == '"') {
+                CS = STR;
+            }
+            else if (c == '$') {
+                CS = REF;
+            }
+            else if (hasClass(c, CC_DELIM)) {
+                CS = DLM;
+            }
+            else {
+                CS = ERR;
+            }
+            pos++;
+            break;
+        }
+
+        case ID: { // Идентификатор или ключевое слово
+            while (available()) {
+                if (hasClass(input[pos], CC_IDENT)) {
+                    pos++;
+                    continue;
+                }
+                if ((unsigned char)input[pos] < 0x80) break;
+                size_t length = identifierChar(false);
+                if (length == 0) break;
+                pos += length;
+            }
+            if (lexicalError == LE_ENCODING) {
+                CS = ERR;
+                break;
+            }
+            size_t end = inputBase + pos;
+            string_view word(input.data() + (lexemeStart - inputBase), end - lexemeStart);
+            int keywordIndex = findKeyword(word);
+            if (keywordIndex != -1) {
+                addToken(KWORD, lexemeStart, end, keywordIndex);
+            }
+            else if ((word == "inf" || word == "nan") && (previousDelimiter == DL_COLON || previousDelimiter == DL_ASSIGN)) {
+                // После ':' и '=' идентификатор недопустим, поэтому там inf и nan -
+                // числа, а в остальных местах остаются обычными именами
+                addToken(NUMERIC, lexemeStart, end, TN.intern(word));
+            }
+            else {
+                addToken(IDENT, lexemeStart, end, TI.intern(word));
+            }
+            return true;
+        }
+
+        case NUM: { // Число
+            if (scanNumber()) return true;
+            CS = ERR;
+            break;
+        }
+
+        case STR: { // Строковый литерал
+            // Закрывающая кавычка ищется блоками по всему окну
+            while (available()) {
+                const char* begin = input.data() + pos;
+                const char* end = input.data() + input.size();
+                const char* quote = findByte(begin, end, '"');
+                pos += quote - begin;
+                if (quote != end) break;
+            }
+            if (available() && input[pos] == '"') {
+                if (!validText(lexemeStart + 1)) {
+                    CS = ERR;
+                    break;
+                }
+                addToken(STRING, lexemeStart + 1, inputBase + pos);
+                pos++; // Пропускаем закрывающую кавычку
+                return true;
+            }
+            CS = ERR; // Незакрытая строка
+            break;
+        }
+
+        case REF: { // Ссылка на константу $[имя]
+            if (available() && input[pos] == '[') {
+                pos++; // Пропускаем '['
+                size_t nameStart = inputBase + pos;
+                while (available()) {
+                    if (hasClass(input[pos], CC_ALPHA | CC_DIGIT)) {
+                        pos++;
+                        continue;
+                    }
+                    if ((unsigned char)input[pos] < 0x80) break;
+                    size_t length = identifierChar(inputBase + pos == nameStart);
+                    if (length == 0) break;
+                    pos += length;
+                }
+                if (lexicalError == LE_ENCODING) {
+                    CS = ERR;
+                    break;
+                }
+                if (available() && input[pos] == ']') {
+                    size_t nameEnd = inputBase + pos;
+                    string_view name(input.data() + (nameStart - inputBase), nameEnd - nameStart);
+                    addToken(REFERENCE, nameStart, nameEnd, TI.intern(name));
+                    pos++; // Пропускаем ']'
+                    return true;
+                }
+            }
+            CS = ERR; // Ошибка в ссылке
+            break;
+        }
+
+        case C1: { // Начало комментария
+            char first = input[lexemeStart - inputBase];
+            // При options.stripComments комментарий пропускается без токенов
+            if (first == '%' && available() && input[pos] == '{') {
+                if (!options.stripComments) addToken(DELIM, lexemeStart, lexemeStart + 2, DL_COMMENT_OPEN);
+                lexemeStart = inputBase + pos; // Тело комментария начинается с '{'
+                CS = C2; // Многострочный комментарий
+            }
+            else if (first == '-' && available() && input[pos] == '-') {
+                pos++;
+                if (!options.stripComments) addToken(DELIM, lexemeStart, lexemeStart + 2, DL_LINE_COMMENT);
+                CS = C3; // Однострочный комментарий
+            }
+            else if (first == '-' && available() && (hasClass(input[pos], CC_DIGIT) || input[pos] == 'i' || input[pos] == 'n')) {
+                CS = NUM; // Отрицательное число
+            }
+            else {
+                CS = ERR;
+            }
+            break;
+        }
+
+        case C2: { // Многострочный комментарий
+            // Тело проверяется на UTF-8 по частям, до того как пропущенная
+            // часть может быть отброшена из окна
+            bool closed = false;
+            size_t checked = lexemeStart;   // Начало непроверенной части тела
+            while (available(1)) {
+                const char* begin = input.data() + pos;
+                const char* limit = input.data() + input.size();
+                const char* close = findPair(begin, limit, '%', '}');
+                if (close != limit) {
+                    pos += close - begin;
+                    closed = true;
+                    break;
+                }
+                // Последний символ окна может оказаться началом "%}".
+                // Пропускаемое тело не удерживается в окне.
+                pos = input.size() - 1;
+                if (!validText(checked)) break;
+                checked = inputBase + pos;
+                if (options.stripComments) lexemeStart = inputBase + pos;
+            }
+            if (lexicalError == LE_ENCODING || (closed && !validText(checked))) {
+                CS = ERR;
+                break;
+            }
+            if (!closed) {
+                pos = input.size();
+                CS = ERR; // Ошибка, если достигли конца ввода без закрывающего символа
+                break;
+            }
+            size_t end = inputBase + pos;
+            pos += 2; // Пропускаем закрывающий символ комментария
+            if (options.stripComments) {
+                CS = H;
+                break;
+            }
+            addToken(COMMENTS, lexemeStart, end, commentCount++);
+            addToken(DELIM, end, end + 2, DL_COMMENT_CLOSE);
+            return true;
+        }
+
+        case C3: { // Однострочный комментарий до конца строки или конца ввода
+            size_t checked = inputBase + pos;
+            while (available()) {
+                const char* begin = input.data() + pos;
+                const char* end = input.data() + input.size();
+                const char* newline = findByte(begin, end, '\n');
+                pos += newline - begin;
+                if (!validText(checked)) break;
+                checked = inputBase + pos;
+                if (newline != end) break;
+                if (options.stripComments) lexemeStart = inputBase + pos;
+            }
+            if (lexicalError == LE_ENCODING) {
+                CS = ERR;
+                break;
+            }
+            size_t end = inputBase + pos;
+            if (available()) pos++; // Пропускаем перевод строки
+            if (options.stripComments) {
+                CS = H;
+                break;
+            }
+            addToken(COMMENTS, lexemeStart, end, commentCount++);
+            return true;
+        }
+
+        case DLM: { // Ограничители
+            int index = delimiterIndex[(unsigned char)input[lexemeStart - inputBase]];
+            addToken(DELIM, lexemeStart, lexemeStart + 1, index);
+            return true;
+        }
+
+        case ERR: {
+            // Ошибка сообщается, когда разбор дойдёт до ошибочной лексемы,
+            // поэтому её место в выводе не зависит от размера окна предпросмотра
+            addToken(LEXERROR, inputBase + pos, inputBase + pos, lexicalError);
+            scannerDone = true;
+            return false;
+        }
+        }
+    }
+}
+
+// Строка JSON в кавычках. Байты вне ASCII выводятся как есть.
+static void writeJsonString(ostream& out, string_view text) {
+    static const char digits[] = "0123456789abcdef";
+    out.put('"');
+    size_t plain = 0;
+    for (size_t i = 0; i < text.size(); i++) {
+        unsigned char c = (unsigned char)text[i];
+        if (c >= 0x20 && c != '"' && c != '\\') continue;
+        out.write(text.data() + plain, (streamsize)(i - plain));
+        plain = i + 1;
+        if (c == '"' || c == '\\') {
+            out.put('\\');
+            out.put((char)c);
+        }
+        else if (c == '\n') {
+            out << "\\n";
+        }
+        else if (c == '\t') {
+            out << "\\t";
+        }
+        else if (c == '\r') {
+            out << "\\r";
+        }
+        else {
+            out << "\\u00" << digits[c >> 4] << digits[c & 15];
+        }
+    }
+    out.write(text.data() + plain, (streamsize)(text.size() - plain));
+    out.put('"');
+}
+
+// Вывод токена. Поток не сбрасывается после каждой строки:
+// печать идёт через буфер потока options.tokenDump.
+void Pipeline::printToken(const Token& token) {
+    ostream& out = *options.tokenDump;
+    string_view value = tokenText(token);
+    if (options.dumpFormat == DumpFormat::JsonLines) {
+        out << "{\"type\":\"" << tokenTypeNames[token.type] << "\",\"index\":" << token.index
+            << ",\"offset\":" << (uint64_t)token.offset << ",\"value\":";
+        writeJsonString(out, value);
+        out << "}\n";
+        return;
+    }
+    switch (token.type) {
+    case KWORD:
+        out << "(1," << token.index << ") Keyword: " << value << '\n';
+        break;
+    case IDENT:
+        out << "(2," << token.index << ") Identifier: " << value << '\n';
+        break;
+    case NUMERIC:
+        out << "(3," << token.index << ") Number: " << value << '\n';
+        break;
+    case DELIM:
+        out << "(4," << token.index << ") Delimiter: " << value << '\n';
+        break;
+    case COMMENTS:
+        out << "(5," << token.index << ") Comments: " << value << '\n';
+        break;
+    case STRING:
+        out << "(6) String: " << value << '\n';
+        break;
+    case REFERENCE:
+        out << "(7) Reference: " << value << '\n';
+        break;
+    }
+}
+
+// СИНТАКСИЧЕСКИЙ АНАЛИЗАТОР
+// Текст значения узла
+string_view Pipeline::nodeValue(const ASTNode* node) {
+    switch (node->kind) {
+    case N_KEY:
+    case N_REFERENCE:
+    case N_IDENTIFIER:
+        return TI.name(node->atom);
+    case N_NUMBER:
+        return TN.name(node->atom);
+    case N_BOOLEAN:
+        return TW[node->atom];
+    case N_STRING:
+    case N_MULTILINE:
+    case N_SINGLE_LINE:
+        return string_view(input.data() + (node->offset - inputBase), node->length);
+    default:
+        return "";
+    }
+}
+
+// Печать поддерева с явным стеком, без рекурсии
+void Pipeline::printNode(ASTNode* root, int depth) {
+    ostream& out = *options.astDump;
+    bool json = options.dumpFormat == DumpFormat::JsonLines;
+    vector<pair<ASTNode*, int>> stack = { { root, depth } };
+    while (!stack.empty()) {
+        ASTNode* node = stack.back().first;
+        int level = stack.back().second;
+        stack.pop_back();
+        if (json) {
+            out << "{\"statement\":" << counters.statements << ",\"depth\":" << level
+                << ",\"kind\":\"" << nodeKindNames[node->kind] << "\",\"value\":";
+            writeJsonString(out, nodeValue(node));
+            out << "}\n";
+        }
+        else {
+            for (int i = 0; i < level; i++) {
+                out << "  ";
+            }
+            out << nodeKindNames[node->kind] << ":" << nodeValue(node) << '\n';
+        }
+        // Порядок печати: узел, левый, правый, следующий ключ
+        if (node->next) stack.push_back({ node->next, level });
+        if (node->right) stack.push_back({ node->right, level + 1 });
+        if (node->left) stack.push_back({ node->left, level + 1 });
+    }
+}
+
+// Функция для получения текущего токена.
+// Окно предпросмотра пополняется сканером, только когда оно опустело.
+const Token& Pipeline::currentToken() {
+    if (tokens.empty()) {
+        StageTimer timer(collectStats);
+        while (tokens.size() < LOOKAHEAD_SIZE && scanner()) {}
+        if (collectStats) scannerSeconds += timer.seconds();
+    }
+    const Token& token = tokens.front();
+    if (token.type == LEXERROR) {
+        if (token.index == LE_RANGE) {
+            throw ConversionError("Лексическая ошибка: число вне допустимого диапазона на позиции " + to_string((uint64_t)token.offset));
+        }
+        if (token.index == LE_ENCODING) {
+            throw ConversionError("Лексическая ошибка: неверная последовательность UTF-8 на позиции " + to_string((uint64_t)token.offset));
+        }
+        throw ConversionError("Лексическая ошибка: неожиданный символ на позиции " + to_string((uint64_t)token.offset));
+    }
+    return token;
+}
+
+// Текст текущего токена
+string_view Pipeline::currentValue() {
+    return tokenText(currentToken());
+}
+
+// Переход к следующему токену
+void Pipeline::nextToken() {
+    if (!(scannerDone && tokens.size() == 1)) {
+        const Token& token = currentToken();
+        consumedEnd = token.offset + token.length;
+        tokens.pop_front();
+        currentIndex++;
+    }
+    else {
+        throw ConversionError("Ошибка: Программа завершилась раньше, чем ожидалось.");
+    }
+}
+
+// Функция для обработки ошибок
+void Pipeline::error(string message) {
+    throw SyntaxError(message, lineIndex, currentIndex);
+}
+
+// Функция match для проверки типа токена и перехода к следующему
+void Pipeline::match(TokenType expectedType, string_view expectedValue) {
+    const Token& token = currentToken();
+
+    // Проверка типа токена
+    if (token.type != expectedType) {
+        error("Поступил тип данных " + string(tokenTypeNames[token.type]) + ", а ожидался " + string(tokenTypeNames[expectedType]));
+    }
+
+    // Проверка значения токена, если оно передано
+    if (!expectedValue.empty() && tokenText(token) != expectedValue) {
+        error("Поступил тип данных " + string(tokenTypeNames[token.type]) + ", а ожидался " + string(tokenTypeNames[expectedType]));
+    }
+
+    // Переход к следующему токену, если проверка пройдена
+    nextToken();
+}
+
+// Создание узла в арене
+ASTNode* Pipeline::makeNode(NodeKind kind, int atom) {
+    counters.nodes++;
+    nodeKindCounts[kind]++;
+    return arena.make<ASTNode>(kind, atom);
+}
+
+// Создание узла, значение которого - текст текущего токена
+ASTNode* Pipeline::makeTokenNode(NodeKind kind) {
+    const Token& token = currentToken();
+    counters.nodes++;
+    nodeKindCounts[kind]++;
+    ASTNode* node = arena.make<ASTNode>(kind, token.index, (uint64_t)token.offset, token.length);
+    // При разборе части запоминаются узлы с атомами TI и TN. Токен проверяется:
+    // узел, созданный перед синтаксической ошибкой, может не иметь атома.
+    bool identAtom = token.type == REFERENCE || (token.type == IDENT && token.length != 0);
+    if (collecting && (kind == N_NUMBER ? token.type == NUMERIC : identAtom)) {
+        atomNodes.push_back(node);
+    }
+    return node;
+}
+
+// Функция для разбора правила S.
+// Каждый оператор верхнего уровня проходит семантический анализ сразу после
+// разбора, пока его лексемы ещё находятся в окне входных данных, после чего
+// все его узлы освобождаются сбросом арены.
+void Pipeline::S() {
+    if (options.astDump && options.dumpFormat == DumpFormat::Text) *options.astDump << "S:\n";
+
+    do {
+        // Время сканера, пополнявшего окно во время разбора, вычитается
+        StageTimer parseTimer(collectStats);
+        double scanned = scannerSeconds;
+        ASTNode* statement = Statement();
+        counters.statements++;
+        if (collectStats) parserSeconds += parseTimer.seconds() - (scannerSeconds - scanned);
+
+        if (collecting) {
+            statements.push_back(statement);
+            continue;
+        }
+        if (options.astDump) printNode(statement, 1);
+        if (stage == ConversionStage::Analyze) {
+            StageTimer semanticTimer(collectStats);
+            double written = outputStats.seconds;
+            semanticAnalysis(tomlEmitter, statement);
+            if (collectStats) semanticSeconds += semanticTimer.seconds() - (outputStats.seconds - written);
+        }
+        arena.reset();
+    } while (currentValue() != "end");
+
+    retainFrom = SIZE_MAX;
+}
+
+// Разбор одного оператора верхнего уровня
+ASTNode* Pipeline::Statement() {
+    currentIndex = 0;
+    retainFrom = currentToken().offset;
+    ASTNode* statement;
+    if (currentValue() == "%{" || currentValue() == "--") {
+        statement = Comment();
+        lineIndex += 1;
+    }
+    else if (currentValue() == "{") {
+        statement = Dictionary();
+        lineIndex += 1;
+    }
+    else {
+        if (currentValue() == "set") {
+            statement = Translation();
+        }
+        else {
+            statement = Assignment();
+        }
+        if (currentValue() == ";") {
+            lineIndex += 1;
+            nextToken();
+        }
+        else {
+            error("Ожидалось ';' после " + string(currentValue()));
+        }
+    }
+    return statement;
+}
+
+// Функция для разбора комментария
+ASTNode* Pipeline::Comment() {
+    ASTNode* node = makeNode(N_COMMENT);
+
+    // Проверка многострочного комментария
+    if (currentValue() == "%{") {
+        match(DELIM, "%{");
+        node->left = makeTokenNode(N_MULTILINE);
+        match(COMMENTS);
+        match(DELIM, "%}");
+    }
+    // Проверка однострочного комментария
+    else if (currentValue() == "--") {
+        match(DELIM, "--");
+        node->left = makeTokenNode(N_SINGLE_LINE);
+        match(COMMENTS);
+    }
+    else {
+        error("Ожидался комментарий");
+    }
+
+    return node;
+}
+
+// Функция для разбора словарей.
+// Вложенные словари разбираются с явным стеком вместо рекурсии через Value().
+ASTNode* Pipeline::Dictionary() {
+    ASTNode* node = makeNode(N_DICTIONARY);
+
+    match(DELIM, "{");
+    parseFrames.clear();
+    parseFrames.push_back({ node, nullptr });
+
+    while (!parseFrames.empty()) {
+        if (currentValue() == "}") {
+            match(DELIM, "}");
+            parseFrames.pop_back();
+            // Вложенный словарь - значение ключа, за ним следует ';'
+            if (!parseFrames.empty()) match(DELIM, ";");
+            continue;
+        }
+
+        ParseFrame& frame = parseFrames.back();
+        ASTNode* newNode = makeTokenNode(N_KEY);
+        match(IDENT);
+
+        match(DELIM, ":");
+
+        // Ключи словаря связаны через next; новый ключ добавляется в хвост
+        if (!frame.last) {
+            frame.dictionary->left = newNode;
+        }
+        else {
+            frame.last->next = newNode;
+        }
+        frame.last = newNode;
+
+        if (currentValue() == "{") {
+            if (parseFrames.size() >= options.maxDepth) {
+                error("Превышена максимальная глубина вложенности словарей");
+            }
+            newNode->right = makeNode(N_DICTIONARY);
+            match(DELIM, "{");
+            parseFrames.push_back({ newNode->right, nullptr });
+            continue;
+        }
+
+        newNode->right = Value();
+
+        match(DELIM, ";");
+    }
+
+    return node;
+}
+
+// Функция для разбора значений
+ASTNode* Pipeline::Value() {
+    if (currentToken().type == STRING) {
+        ASTNode* node = makeTokenNode(N_STRING);
+        match(STRING);
+        return node;
+    }
+    else if (currentValue() == "{") {
+        return Dictionary();
+    }
+    else if (currentValue() == "false" || currentValue() == "true") {
+        ASTNode* node = makeTokenNode(N_BOOLEAN);
+        match(KWORD);
+        return node;
+    }
+    else if (currentToken().type == NUMERIC) {
+        ASTNode* node = makeTokenNode(N_NUMBER);
+        match(NUMERIC);
+        return node;
+    }
+    else if (currentToken().type == REFERENCE) {
+        return Reference();
+    }
+    else {
+        error("Ожидалось значение");
+        return nullptr;
+    }
+}
+
+// Функция для разбора ссылок на константы
+ASTNode* Pipeline::Reference() {
+    ASTNode* node = makeTokenNode(N_REFERENCE);
+    match(REFERENCE);
+    return node;
+}
+
+// Функция для разбора константных значений
+ASTNode* Pipeline::Translation() {
+    ASTNode* node = makeNode(N_TRANSLATION);
+
+    match(KWORD, "set");
+    node->left = makeTokenNode(N_IDENTIFIER);
+    match(IDENT);
+    match(DELIM, "=");
+
+    node->right = Value();
+
+    return node;
+}
+
+// Функция для разбора присваивания
+ASTNode* Pipeline::Assignment() {
+    ASTNode* node = makeNode(N_ASSIGNMENT);
+
+    node->left = makeTokenNode(N_IDENTIFIER);
+    match(IDENT);
+    match(DELIM, "=");
+    node->right = Reference();
+
+    return node;
+}
+
+// СЕМАНТИЧЕСКИЙ АНАЛИЗАТОР
+// Получение номера пути для имени atom внутри пути parent
+int Pipeline::pathOf(int parent, int atom) {
+    uint64_t key = ((uint64_t)(uint32_t)parent << 32) | (uint32_t)atom;
+    auto it = pathIds.find(key);
+    if (it != pathIds.end()) return it->second;
+    int path = paths.size();
+    paths.push_back({ parent, atom });
+    pathIds.emplace(key, path);
+    return path;
+}
+
+// Полное имя пути через точку
+string Pipeline::pathName(int path) {
+    vector<int> atoms;
+    for (; path != 0; path = paths[path].first) {
+        atoms.push_back(paths[path].second);
+    }
+    string name;
+    for (auto it = atoms.rbegin(); it != atoms.rend(); ++it) {
+        if (!name.empty()) name += '.';
+        name += TI.name(*it);
+    }
+    return name;
+}
+
+// Запись таблицы символов для пути
+Symbol& Pipeline::symbolOf(int path) {
+    if (collectStats) symbolLookups.fetch_add(1, memory_order_relaxed);
+    if (path >= (int)globalSymbols.size()) globalSymbols.resize(paths.size());
+    return globalSymbols[path];
+}
+
+// Функция для обработки ошибок
+void Pipeline::semanticError(string message) {
+    throw ConversionError("Семантическая ошибка: " + message);
+}
+
+// Отмечен ли символ как константа. Скалярные константы хранят значение
+// вместо отметки, поэтому отмечены только константы-словари и ключи,
+// ссылающиеся на них.
+static bool markedConstant(const Symbol& symbol) {
+    return symbol.value && (symbol.value == constMarker || symbol.value->dictionary);
+}
+
+// Объявление переменной или константы в глобальной области видимости
+void Pipeline::declareVariable(int path, string varType) {
+    Symbol& symbol = symbolOf(path);
+    if (symbol.declared) {
+        if (markedConstant(symbol)) {
+            semanticError("Константа '" + pathName(path) + "' уже объявлена и не может быть изменена.");
+        }
+        if (varType == "const") {
+            semanticError("Переменная '" + pathName(path) + "' уже объявлена и не может быть переопределена как константа.");
+        }
+        // Если переменная уже объявлена как 'var', разрешаем переопределение без ошибки
+    }
+    symbol.declared = true;
+    symbol.value = varType == "const" ? constMarker : varMarker;
+}
+
+// Поиск переменной или константы в глобальной области видимости
+string Pipeline::lookupVariable(int path) {
+    Symbol& symbol = symbolOf(path);
+    return symbol.declared && symbol.value ? symbol.value->text : "";
+}
+
+// Получение значения константы по атому её имени
+const ConstantRef& Pipeline::getConstantValue(int atom) {
+    if (collectStats) constantLookups.fetch_add(1, memory_order_relaxed);
+    Symbol& symbol = symbolOf(pathOf(0, atom));
+    if (!symbol.declared) {
+        semanticError("Константа '" + TI.name(atom) + "' не определена");
+    }
+    return symbol.value ? symbol.value : emptyValue;
+}
+
+// ГЕНЕРАЦИЯ TOML
+// Имя ключа; имена вне ASCII - в кавычках (writeKeyName)
+void Pipeline::writeName(Emitter& emitter, int atom) {
+    writeKeyName(emitter.out, TI.name(atom));
+}
+
+// Полные имена ключей пишутся в вывод по сегментам стека пути
+// и не собираются в отдельные строки.
+void Pipeline::writePath(Emitter& emitter) {
+    for (size_t i = 0; i < emitter.pathStack.size(); i++) {
+        if (i > 0) emitter.out.put('.');
+        writeName(emitter, emitter.pathStack[i]);
+    }
+}
+
+// Заголовок таблицы для текущего пути path
+void Pipeline::writeTableHeader(Emitter& emitter, int path) {
+    emitter.out.put('[');
+    writePath(emitter);
+    emitter.out.write("]\n");
+    if (emitter.compiled) emitter.compiled->table(compiledPath(emitter, path));
+}
+
+// Полное имя текущего пути генератора и, если задан, ключа atom в нём
+string Pipeline::emittedPath(Emitter& emitter, int atom) {
+    string name;
+    for (int segment : emitter.pathStack) {
+        if (!name.empty()) name += '.';
+        name += TI.name(segment);
+    }
+    if (atom >= 0) {
+        if (!name.empty()) name += '.';
+        name += TI.name(atom);
+    }
+    return name;
+}
+
+// Путь path ключа atom текущего пути (atom < 0 - самого текущего пути)
+// для образа документа. Имя пути строится только при первом появлении.
+int Pipeline::compiledPath(Emitter& emitter, int path, int atom) {
+    if (!emitter.compiled->hasPath(path)) emitter.compiled->definePath(path, emittedPath(emitter, atom));
+    return path;
+}
+
+// Запись "имя = " для ключа atom внутри текущего пути
+void Pipeline::writeKey(Emitter& emitter, int atom) {
+    writePath(emitter);
+    if (!emitter.pathStack.empty()) emitter.out.put('.');
+    writeName(emitter, atom);
+    emitter.out.write(" = ");
+}
+
+// Запись скалярного значения узла; значение ссылки передаётся уже найденным
+void Pipeline::writeValue(Emitter& emitter, ASTNode* value, const ConstantValue* referenced) {
+    if (value->kind == N_STRING) {
+        emitter.out.put('"');
+        emitter.out.write(nodeValue(value));
+        emitter.out.put('"');
+    }
+    else if (value->kind == N_REFERENCE) {
+        emitter.out.write(referenced->text);
+    }
+    else {
+        emitter.out.write(nodeValue(value));
+    }
+}
+
+// Вывод словаря-константы в таблицу текущего пути генератора с путём path.
+// Вложенные словари выводятся до следующих ключей, как при анализе словаря.
+// Пути ключей нужны только образу документа, который собирается
+// последовательно, поэтому без него они не интернируются.
+void Pipeline::writeDictionary(Emitter& emitter, const ConstantValue& dictionary, int path) {
+    writeTableHeader(emitter, path);
+    size_t basePath = emitter.pathStack.size();
+    emitter.constantFrames.clear();
+    emitter.constantFrames.push_back({ &dictionary, 0, path });
+
+    while (!emitter.constantFrames.empty()) {
+        ConstantFrame& frame = emitter.constantFrames.back();
+        if (frame.next == frame.dictionary->keys.size()) {
+            emitter.constantFrames.pop_back();
+            if (emitter.pathStack.size() > basePath) emitter.pathStack.pop_back();
+            continue;
+        }
+        const auto& key = frame.dictionary->keys[frame.next++];
+        int keyPath = emitter.compiled ? pathOf(frame.path, key.first) : 0;
+        if (key.second->dictionary) {
+            emitter.pathStack.push_back(key.first);
+            writeTableHeader(emitter, keyPath);
+            emitter.constantFrames.push_back({ key.second.get(), 0, keyPath });
+            continue;
+        }
+        writeKey(emitter, key.first);
+        emitter.out.write(key.second->text);
+        emitter.out.put('\n');
+        if (emitter.compiled) emitter.compiled->value(compiledPath(emitter, keyPath, key.first), key.second->text);
+    }
+}
+
+// Значение скалярного узла для таблицы символов; ссылка разделяет
+// значение константы
+ConstantRef Pipeline::constantOf(ASTNode* value) {
+    if (value->kind == N_REFERENCE) {
+        return getConstantValue(value->atom);
+    }
+    if (value->kind == N_STRING) {
+        return make_shared<const ConstantValue>("\"" + string(nodeValue(value)) + "\"");
+    }
+    return make_shared<const ConstantValue>(string(nodeValue(value)));
+}
+
+// Запись комментария: каждая строка тела - отдельная строка "# ..."
+void Pipeline::writeComment(Emitter& emitter, string_view text) {
+    while (!text.empty()) {
+        const char* end = findByte(text.data(), text.data() + text.size(), '\n');
+        size_t length = end - text.data();
+        emitter.out.write("# ");
+        emitter.out.write(text.substr(0, length));
+        emitter.out.put('\n');
+        text.remove_prefix(length < text.size() ? length + 1 : length);
+    }
+}
+
+// Нерекурсивный анализ словаря с путём path.
+// Вложенные словари обходятся с явным стеком в том же порядке, что и при
+// рекурсивном обходе, поэтому глубина вложенности ограничена только памятью.
+// Если задан constant, в него собирается значение словаря-константы.
+void Pipeline::analyzeDictionary(Emitter& emitter, ASTNode* dictionary, int path, ConstantValue* constant) {
+    // Обработка словаря (таблицы в TOML)
+    if (path != 0) {
+        writeTableHeader(emitter, path);
+    }
+
+    size_t basePath = emitter.pathStack.size();
+    emitter.dictionaryFrames.clear();
+    emitter.dictionaryFrames.push_back({ dictionary->left, path, constant });
+
+    while (!emitter.dictionaryFrames.empty()) {
+        DictionaryFrame& frame = emitter.dictionaryFrames.back();
+        ASTNode* node = frame.key;
+        if (!node) {
+            emitter.dictionaryFrames.pop_back();
+            if (emitter.pathStack.size() > basePath) emitter.pathStack.pop_back();
+            continue;
+        }
+        frame.key = node->next;
+        ConstantValue* building = frame.constant;
+
+        // Обработка ключа в словаре
+        int keyPath = pathOf(frame.path, node->atom);
+        bool topLevel = frame.path == 0;
+        if (topLevel && !replayed(keyPath)) continue;
+
+        // Проверка на повторное объявление ключа
+        if (symbolOf(keyPath).declared) {
+            semanticError("Ключ '" + pathName(keyPath) + "' уже объявлен");
+        }
+
+        // Обрабатываем значение ключа
+        if (!node->right) {
+            semanticError("Ключ '" + pathName(keyPath) + "' не имеет значения");
+        }
+        if (node->right->kind == N_DICTIONARY) {
+            // Вложенный словарь обрабатывается до следующих ключей текущего
+            ConstantValue* nested = nullptr;
+            if (building) {
+                auto value = make_shared<ConstantValue>();
+                nested = value.get();
+                building->keys.push_back({ node->atom, move(value) });
+            }
+            emitter.pathStack.push_back(node->atom);
+            writeTableHeader(emitter, keyPath);
+            emitter.dictionaryFrames.push_back({ node->right->left, keyPath, nested });
+            continue;
+        }
+        if (node->right->kind != N_STRING && node->right->kind != N_NUMBER &&
+            node->right->kind != N_BOOLEAN && node->right->kind != N_REFERENCE) {
+            semanticError("Недопустимый тип значения для ключа '" + pathName(keyPath) + "'");
+        }
+
+        // Ссылка разрешается до записи ключа, чтобы при ошибке
+        // в выводе не осталось незаконченной строки
+        ConstantRef referenced;
+        if (node->right->kind == N_REFERENCE) referenced = getConstantValue(node->right->atom);
+
+        // Генерируем TOML-код для ключа; ссылка на словарь-константу
+        // становится вложенной таблицей
+        if (referenced && referenced->dictionary) {
+            emitter.pathStack.push_back(node->atom);
+            writeDictionary(emitter, *referenced, keyPath);
+            emitter.pathStack.pop_back();
+        }
+        else {
+            writeKey(emitter, node->atom);
+            writeValue(emitter, node->right, referenced.get());
+            emitter.out.put('\n');
+        }
+
+        // Добавляем ключ в глобальную область видимости. На значение можно
+        // сослаться только у ключей верхнего уровня, вложенным достаточно отметки.
+        ConstantRef value;
+        if (topLevel || building || emitter.compiled) value = referenced ? move(referenced) : constantOf(node->right);
+        if (emitter.compiled && !value->dictionary) {
+            emitter.compiled->value(compiledPath(emitter, keyPath, node->atom), value->text);
+        }
+        if (building) building->keys.push_back({ node->atom, value });
+        Symbol& symbol = symbolOf(keyPath);
+        symbol.declared = true;
+        symbol.value = topLevel ? move(value) : nullptr;
+    }
+}
+
+// Семантический анализ оператора верхнего уровня
+void Pipeline::semanticAnalysis(Emitter& emitter, ASTNode* node) {
+    if (!node) return;
+
+    if (node->kind == N_TRANSLATION) {
+        // Обработка объявления константы с использованием 'set'
+        int constAtom = node->left->atom;
+        int constPath = pathOf(0, constAtom);
+        if (!replayed(constPath)) return;
+
+        // Объявляем или обновляем константу
+        declareVariable(constPath, "const");
+
+        // Генерируем TOML-код для константы или словаря
+        if (node->right->kind == N_NUMBER || node->right->kind == N_STRING ||
+            node->right->kind == N_BOOLEAN || node->right->kind == N_REFERENCE) {
+            // Сохраняем значение константы; ссылка разделяет значение
+            ConstantRef constValue = constantOf(node->right);
+            symbolOf(constPath).value = constValue;
+
+            if (constValue->dictionary) {
+                emitter.pathStack.push_back(constAtom);
+                writeDictionary(emitter, *constValue, constPath);
+                emitter.pathStack.pop_back();
+            }
+            else {
+                writeName(emitter, constAtom);
+                emitter.out.write(" = ");
+                emitter.out.write(constValue->text);
+                emitter.out.put('\n');
+                if (emitter.compiled) emitter.compiled->value(compiledPath(emitter, constPath, constAtom), constValue->text);
+            }
+        }
+        else if (node->right->kind == N_DICTIONARY) {
+            // Обрабатываем словарь, собирая его значение для ссылок $[...].
+            // До конца анализа на константу ссылается отметка "const".
+            auto constValue = make_shared<ConstantValue>();
+            emitter.pathStack.push_back(constAtom);
+            analyzeDictionary(emitter, node->right, constPath, constValue.get());
+            emitter.pathStack.pop_back();
+            symbolOf(constPath).value = move(constValue);
+        }
+        else {
+            semanticError("Недопустимый тип значения в 'set' выражении для '" + TI.name(constAtom) + "'");
+        }
+    }
+    else if (node->kind == N_ASSIGNMENT) {
+        // Обработка присваивания переменной значения из константы
+        int varAtom = node->left->atom;
+        int varPath = pathOf(0, varAtom);
+        if (!replayed(varPath)) return;
+
+        // Проверяем, была ли переменная объявлена ранее
+        Symbol& symbol = symbolOf(varPath);
+        if (!symbol.declared) {
+            // Если переменная не объявлена, объявляем её как переменную
+            declareVariable(varPath, "var");
+        }
+        else {
+            if (markedConstant(symbol)) {
+                semanticError("Константу '" + TI.name(varAtom) + "' нельзя изменять.");
+            }
+            // Если переменная уже объявлена как 'var', разрешаем присваивание
+        }
+
+        // Проверяем, что значение присваивается из константы
+        if (node->right && node->right->kind == N_REFERENCE) {
+            const ConstantRef& constValue = getConstantValue(node->right->atom);
+
+            // Генерируем TOML-код для переменной; словарь-константа
+            // выводится таблицей переменной
+            if (constValue->dictionary) {
+                emitter.pathStack.push_back(varAtom);
+                writeDictionary(emitter, *constValue, varPath);
+                emitter.pathStack.pop_back();
+                return;
+            }
+            writeName(emitter, varAtom);
+            emitter.out.write(" = ");
+            emitter.out.write(constValue->text);
+            emitter.out.put('\n');
+            if (emitter.compiled) emitter.compiled->value(compiledPath(emitter, varPath, varAtom), constValue->text);
+        }
+        else {
+            semanticError("Ожидалось имя константы в правой части присваивания");
+        }
+    }
+    else if (node->kind == N_DICTIONARY) {
+        analyzeDictionary(emitter, node, 0);
+    }
+    else if (node->kind == N_COMMENT && !replaying) {
+        // Комментарии
+        writeComment(emitter, nodeValue(node->left));
+        if (emitter.compiled) emitter.compiled->comment(nodeValue(node->left));
+    }
+}
+
+// Анализируется ли корневой путь. При повторном анализе для восстановления
+// символов обрабатываются только очищенные корневые пути.
+bool Pipeline::replayed(int root) const {
+    return !replaying || (root < (int)rootFlags.size() && (rootFlags[root] & ROOT_REBUILT));
+}
+
+// ПРЕОБРАЗОВАНИЕ
+// Очистка состояния сканера и окна предпросмотра
+void Pipeline::resetScanner() {
+    inputStream = nullptr;
+    window.clear();
+    input = string_view();
+    inputBase = 0;
+    pos = 0;
+    lexemeStart = 0;
+    retainFrom = SIZE_MAX;
+    inputEnded = false;
+
+    tokens.clear();
+    scannerDone = false;
+    previousDelimiter = -1;
+    lexicalError = LE_UNEXPECTED;
+
+    commentCount = 0;
+    currentIndex = 0;
+    counters = ConversionCounters();
+
+    collectStats = options.stats;
+    scannerSeconds = parserSeconds = semanticSeconds = totalSeconds = 0;
+    outputStats = OutputStats();
+    tomlOutput.setStats(collectStats ? &outputStats : nullptr);
+    tokenTypeCounts.fill(0);
+    nodeKindCounts.fill(0);
+    symbolLookups = 0;
+    constantLookups = 0;
+
+    arena.reset();
+    parseFrames.clear();
+}
+
+// Очистка состояния сканера и синтаксического анализатора
+void Pipeline::resetParser() {
+    resetScanner();
+    TI.clear();
+    TN.clear();
+    lineIndex = 1;
+
+    collecting = false;
+    statements.clear();
+    atomNodes.clear();
+    stopped = false;
+    chunkError = nullptr;
+}
+
+// Очистка таблицы символов и состояния генератора
+void Pipeline::resetSemantics() {
+    paths.assign(1, { -1, -1 });
+    pathIds.clear();
+    globalSymbols.clear();
+    tomlEmitter.pathStack.clear();
+    tomlEmitter.dictionaryFrames.clear();
+    pathRoots.clear();
+    subtreeNext.clear();
+    rootFlags.clear();
+}
+
+void Pipeline::reset(istream& in) {
+    resetParser();
+    resetSemantics();
+    inputStream = &in;
+}
+
+// Текст в памяти приводится к виду, который получил бы потоковый сканер:
+// строка "exit" завершает вход, а последняя строка оканчивается переводом строки.
+static string_view prepareText(string_view text, string& storage) {
+    // Строка "exit" ищется по началам строк на 'e': пара "\ne" встречается
+    // в тексте гораздо реже, чем сама буква
+    const char* data = text.data();
+    const char* end = data + text.size();
+    const char* line = data;
+    while (line != end) {
+        size_t at = line - data;
+        bool lineEnd = at + 4 == text.size() || (at + 4 < text.size() && text[at + 4] == '\n');
+        if (lineEnd && text.compare(at, 4, "exit") == 0) {
+            text = text.substr(0, at);
+            break;
+        }
+        line = findPair(line, end, '\n', 'e');
+        if (line != end) line++;
+    }
+    if (!text.empty() && text.back() != '\n') {
+        storage.assign(text.data(), text.size());
+        storage += '\n';
+        return storage;
+    }
+    return text;
+}
+
+void Pipeline::reset(string_view text) {
+    resetParser();
+    resetSemantics();
+    input = prepareText(text, window);
+    inputEnded = true;
+}
+
+// Лексический, синтаксический и семантический анализ выполняются
+// по операторам верхнего уровня по мере чтения входа, TOML-код
+// выводится сразу после анализа каждого оператора
+void Pipeline::run() {
+    bool parallel = !inputStream && options.threads > 1 && !options.tokenDump && !options.astDump && !tomlEmitter.compiled;
+    if (stage == ConversionStage::Scan) {
+        // Токены выбираются так же, как их выбирает разбор, но не разбираются
+        while (!(scannerDone && tokens.size() == 1)) nextToken();
+        currentToken();
+    }
+    else if (parallel && stage == ConversionStage::Analyze && input.size() >= 2 * PARALLEL_CHUNK_MIN) {
+        runParallel();
+    }
+    else {
+        S();
+    }
+}
+
+// ПАРАЛЛЕЛЬНЫЙ РАЗБОР
+// Вход в памяти делится на части по границам операторов верхнего уровня.
+// Части разбираются несколькими потоками, каждый в своём конвейере со своими
+// таблицами и ареной, а семантический анализ и вывод выполняет главный
+// конвейер по частям в порядке входа. Результат совпадает с последовательным.
+
+// Поиск границ частей. Граница ставится у первой после очередной отметки
+// chunkSize позиции, где заканчивается оператор верхнего уровня: после ';'
+// вне словарей, после '}' словаря-оператора и после комментария. Строки и
+// комментарии пропускаются целиком, так же как их пропускает сканер.
+static vector<size_t> findSplitPoints(string_view text, size_t chunkSize) {
+    vector<size_t> bounds = { 0 };
+    const char* data = text.data();
+    const char* end = data + text.size();
+    size_t n = text.size();
+    size_t target = chunkSize;
+    size_t depth = 0;             // Глубина вложенности словарей
+    bool statementStart = true;   // Позиция в начале оператора
+    bool bareDictionary = false;  // Открытый словарь - отдельный оператор
+
+    size_t i = 0;
+    while (i < n) {
+        char c = text[i];
+        size_t boundary = 0;
+        if (hasClass(c, CC_SPACE)) {
+            i++;
+            continue;
+        }
+        if (c == '"') {
+            const char* quote = findByte(data + i + 1, end, '"');
+            if (quote == end) break;
+            i = quote - data + 1;
+            statementStart = false;
+        }
+        else if (c == '%' && i + 1 < n && text[i + 1] == '{') {
+            const char* close = findPair(data + i + 1, end, '%', '}');
+            if (close == end) break;
+            i = close - data + 2;
+            if (depth == 0) boundary = i;
+        }
+        else if (c == '-' && i + 1 < n && text[i + 1] == '-') {
+            const char* newline = findByte(data + i + 2, end, '\n');
+            i = newline == end ? n : newline - data + 1;
+            if (depth == 0) boundary = i;
+        }
+        else if (c == '{') {
+            if (depth == 0) bareDictionary = statementStart;
+            depth++;
+            i++;
+            statementStart = false;
+        }
+        else if (c == '}') {
+            i++;
+            if (depth > 0 && --depth == 0 && bareDictionary) boundary = i;
+            statementStart = false;
+        }
+        else if (c == ';') {
+            i++;
+            if (depth == 0) boundary = i;
+            statementStart = false;
+        }
+        else {
+            i++;
+            statementStart = false;
+        }
+
+        if (boundary != 0) {
+            statementStart = true;
+            if (boundary >= target && boundary < n) {
+                bounds.push_back(boundary);
+                target = boundary + chunkSize;
+            }
+        }
+    }
+    bounds.push_back(n);
+    return bounds;
+}
+
+// Разбор части [begin, end) текста text без семантического анализа
+void Pipeline::parseChunk(string_view text, size_t begin, size_t end, bool first) {
+    resetParser();
+    collecting = true;
+    input = text.substr(begin, end - begin);
+    inputBase = begin;
+    inputEnded = true;
+    try {
+        // Часть, кроме первой, начинается там, где S() уже проверил бы конец входа
+        if (first || currentValue() != "end") S();
+        stopped = tokens.front().length != 0;
+    }
+    catch (const ConversionError&) {
+        chunkError = current_exception();
+    }
+}
+
+// Семантический анализ разобранной части. Возвращает false, если после
+// неё разбор не продолжается.
+bool Pipeline::analyzeChunk(Pipeline& chunk) {
+    // Атомы части переводятся в атомы таблиц главного конвейера
+    identMap.resize(chunk.TI.names.size());
+    for (size_t i = 0; i < identMap.size(); i++) identMap[i] = TI.intern(chunk.TI.name(i));
+    numberMap.resize(chunk.TN.names.size());
+    for (size_t i = 0; i < numberMap.size(); i++) numberMap[i] = TN.intern(chunk.TN.name(i));
+    for (ASTNode* node : chunk.atomNodes) {
+        node->atom = node->kind == N_NUMBER ? numberMap[node->atom] : identMap[node->atom];
+    }
+
+    StageTimer semanticTimer(collectStats);
+    double written = outputStats.seconds;
+    analyzeStatements(chunk.statements);
+    if (collectStats) semanticSeconds += semanticTimer.seconds() - (outputStats.seconds - written);
+    scannerSeconds += chunk.scannerSeconds;
+    parserSeconds += chunk.parserSeconds;
+    for (size_t i = 0; i < tokenTypeCounts.size(); i++) tokenTypeCounts[i] += chunk.tokenTypeCounts[i];
+    for (size_t i = 0; i < nodeKindCounts.size(); i++) nodeKindCounts[i] += chunk.nodeKindCounts[i];
+    counters.tokens += chunk.counters.tokens;
+    counters.nodes += chunk.counters.nodes;
+    counters.statements += chunk.counters.statements;
+
+    if (chunk.chunkError) {
+        try {
+            rethrow_exception(chunk.chunkError);
+        }
+        catch (const SyntaxError& e) {
+            // Номер строки - номер оператора во всём входе
+            throw SyntaxError(e.message, lineIndex, e.index);
+        }
+    }
+    return !chunk.stopped;
+}
+
+// ПАРАЛЛЕЛЬНЫЙ СЕМАНТИЧЕСКИЙ АНАЛИЗ
+// Оператор изменяет символы только своих корневых путей (имени константы
+// или переменной, ключей верхнего уровня словаря) и вложенных в них,
+// а читает ещё символы констант, на которые ссылается через $[...].
+// Поэтому объявление упорядочивается после предыдущих объявлений и чтений
+// того же корневого пути, чтение - после предыдущего объявления, а
+// независимые операторы анализируются одновременно. Вывод каждого
+// оператора пишется в свой буфер, и буферы выводятся в порядке входа.
+
+// Интернирование всех путей оператора и сбор его корневых путей в
+// writtenPaths и readPaths. После этого анализ только читает таблицу путей.
+void Pipeline::collectPaths(ASTNode* statement) {
+    writtenPaths.clear();
+    readPaths.clear();
+    ASTNode* dictionary = nullptr;
+    int dictionaryPath = 0;
+
+    if (statement->kind == N_TRANSLATION || statement->kind == N_ASSIGNMENT) {
+        int root = pathOf(0, statement->left->atom);
+        writtenPaths.push_back(root);
+        ASTNode* value = statement->right;
+        if (value && value->kind == N_REFERENCE) {
+            readPaths.push_back(pathOf(0, value->atom));
+        }
+        else if (value && value->kind == N_DICTIONARY) {
+            dictionary = value;
+            dictionaryPath = root;
+        }
+    }
+    else if (statement->kind == N_DICTIONARY) {
+        dictionary = statement;
+    }
+    if (!dictionary) return;
+
+    collectFrames.clear();
+    collectFrames.push_back({ dictionary->left, dictionaryPath });
+    while (!collectFrames.empty()) {
+        DictionaryFrame& frame = collectFrames.back();
+        ASTNode* node = frame.key;
+        if (!node) {
+            collectFrames.pop_back();
+            continue;
+        }
+        frame.key = node->next;
+
+        int keyPath = pathOf(frame.path, node->atom);
+        if (frame.path == 0) writtenPaths.push_back(keyPath);
+        if (!node->right) continue;
+        if (node->right->kind == N_DICTIONARY) {
+            collectFrames.push_back({ node->right->left, keyPath });
+        }
+        else if (node->right->kind == N_REFERENCE) {
+            readPaths.push_back(pathOf(0, node->right->atom));
+        }
+    }
+}
+
+// Анализ пакета операторов несколькими потоками с тем же выводом и теми же
+// ошибками, что и при последовательном анализе
+void Pipeline::analyzeStatements(const vector<ASTNode*>& batch) {
+    size_t count = batch.size();
+    waiting.assign(count, 0);
+    if (successors.size() < count) successors.resize(count);
+    if (statementOutput.size() < count) statementOutput.resize(count);
+    statementErrors.assign(count, nullptr);
+
+    // Граф зависимостей между операторами пакета
+    for (size_t i = 0; i < count; i++) {
+        successors[i].clear();
+        statementOutput[i].clear();
+        collectPaths(batch[i]);
+        if (lastWriter.size() < paths.size()) {
+            lastWriter.resize(paths.size(), -1);
+            lastReader.resize(paths.size(), -1);
+        }
+
+        auto dependOn = [&](int previous) {
+            // Все зависимости оператора i добавляются подряд, поэтому
+            // повтор виден по последнему элементу списка
+            if (previous == -1 || previous == (int)i) return;
+            if (!successors[previous].empty() && successors[previous].back() == (int)i) return;
+            successors[previous].push_back((int)i);
+            waiting[i]++;
+        };
+        auto touch = [&](int path) {
+            if (lastWriter[path] == -1 && lastReader[path] == -1) batchPaths.push_back(path);
+        };
+
+        for (int path : readPaths) {
+            touch(path);
+            dependOn(lastWriter[path]);
+            readRecords.push_back({ (int)i, lastReader[path] });
+            lastReader[path] = (int)readRecords.size() - 1;
+        }
+        for (int path : writtenPaths) {
+            touch(path);
+            dependOn(lastWriter[path]);
+            for (int record = lastReader[path]; record != -1; record = readRecords[record].second) {
+                dependOn(readRecords[record].first);
+            }
+            lastReader[path] = -1;
+            lastWriter[path] = (int)i;
+        }
+    }
+    for (int path : batchPaths) {
+        lastWriter[path] = -1;
+        lastReader[path] = -1;
+    }
+    batchPaths.clear();
+    readRecords.clear();
+    if (globalSymbols.size() < paths.size()) globalSymbols.resize(paths.size());
+
+    unsigned threadCount = max(options.threads, 1u);
+    while (analysisWorkers.size() < threadCount) analysisWorkers.emplace_back(new AnalysisWorker());
+
+    mutex guard;
+    condition_variable changed;
+    deque<int> ready;
+    size_t finished = 0;
+    size_t failedAt = SIZE_MAX;  // Первый оператор с ошибкой
+    for (size_t i = 0; i < count; i++) {
+        if (waiting[i] == 0) ready.push_back((int)i);
+    }
+
+    auto worker = [&](unsigned index) {
+        AnalysisWorker& analysis = *analysisWorkers[index];
+        unique_lock<mutex> lock(guard);
+        while (true) {
+            changed.wait(lock, [&] { return !ready.empty() || finished == count; });
+            if (ready.empty()) return;
+            size_t i = ready.front();
+            ready.pop_front();
+            // Операторы после ошибочного не выводятся, их анализ не нужен
+            bool skip = i > failedAt;
+            lock.unlock();
+
+            if (!skip) {
+                analysis.out.setString(&statementOutput[i]);
+                // Любое исключение (и нехватка памяти) сохраняется и передаётся
+                // дальше после завершения всех потоков
+                try {
+                    semanticAnalysis(analysis.emitter, batch[i]);
+                }
+                catch (...) {
+                    statementErrors[i] = current_exception();
+                }
+                analysis.out.flush();
+                analysis.emitter.pathStack.clear();
+            }
+
+            lock.lock();
+            if (statementErrors[i] && i < failedAt) failedAt = i;
+            finished++;
+            bool wake = finished == count;
+            for (int next : successors[i]) {
+                if (--waiting[next] == 0) {
+                    ready.push_back(next);
+                    wake = true;
+                }
+            }
+            if (wake) changed.notify_all();
+        }
+    };
+
+    analysisPool.run(threadCount, worker);
+
+    // Вывод в порядке входа до первого ошибочного оператора включительно
+    size_t last = failedAt == SIZE_MAX ? count : failedAt + 1;
+    for (size_t i = 0; i < last; i++) tomlOutput.write(statementOutput[i]);
+    lineIndex += (int)last;
+    if (failedAt != SIZE_MAX) rethrow_exception(statementErrors[failedAt]);
+}
+
+void Pipeline::runParallel() {
+    string_view text = input;
+    unsigned threadCount = options.threads;
+    size_t chunkSize = text.size() / (threadCount * 4);
+    chunkSize = min(max(chunkSize, PARALLEL_CHUNK_MIN), PARALLEL_CHUNK_MAX);
+    vector<size_t> bounds = findSplitPoints(text, chunkSize);
+    size_t chunkCount = bounds.size() - 1;
+
+    // Число одновременно разобранных частей ограничено числом конвейеров,
+    // поэтому память не зависит от размера входа
+    size_t slots = threadCount * 2;
+    while (chunkParsers.size() < slots) chunkParsers.emplace_back(new Pipeline(options));
+    for (auto& parser : chunkParsers) parser->options = options;
+
+    mutex guard;
+    condition_variable changed;
+    size_t consumed = 0;                      // Части, уже проанализированные
+    vector<size_t> ready(slots, SIZE_MAX);    // Номер части, разобранной в конвейере
+    atomic<size_t> nextChunk(0);
+    bool abort = false;
+
+    auto worker = [&]() {
+        while (true) {
+            size_t chunk = nextChunk++;
+            if (chunk >= chunkCount) return;
+            {
+                // Конвейер освобождается, когда проанализирована часть chunk - slots
+                unique_lock<mutex> lock(guard);
+                changed.wait(lock, [&] { return abort || chunk < consumed + slots; });
+                if (abort) return;
+            }
+            chunkParsers[chunk % slots]->parseChunk(text, bounds[chunk], bounds[chunk + 1], chunk == 0);
+            {
+                lock_guard<mutex> lock(guard);
+                ready[chunk % slots] = chunk;
+            }
+            changed.notify_all();
+        }
+    };
+
+    vector<thread> threads;
+    for (unsigned t = 0; t < threadCount; t++) threads.emplace_back(worker);
+    auto stop = [&]() {
+        {
+            lock_guard<mutex> lock(guard);
+            abort = true;
+        }
+        changed.notify_all();
+        for (thread& t : threads) t.join();
+    };
+
+    try {
+        for (size_t chunk = 0; chunk < chunkCount; chunk++) {
+            {
+                unique_lock<mutex> lock(guard);
+                changed.wait(lock, [&] { return ready[chunk % slots] == chunk; });
+            }
+            bool more = analyzeChunk(*chunkParsers[chunk % slots]);
+            {
+                lock_guard<mutex> lock(guard);
+                consumed = chunk + 1;
+            }
+            changed.notify_all();
+            if (!more) break;
+        }
+    }
+    catch (...) {
+        stop();
+        throw;
+    }
+    stop();
+}
+
+// ИНКРЕМЕНТАЛЬНОЕ ПРЕОБРАЗОВАНИЕ
+// Документ хранится как последовательность операторов верхнего уровня:
+// конец каждого в тексте, начало его TOML-кода и его корневые пути.
+// Лексемы оператора не выходят за его конец, а после оператора сканер
+// возвращается в начальное состояние. Поэтому операторы, закончившиеся до
+// первого изменённого байта, не разбираются заново, а разбор останавливается
+// на операторе, конец которого совпал с концом прежнего оператора в
+// неизменной части текста: дальше идут прежние операторы.
+//
+// Символы корневого пути и вложенных в него путей меняют только операторы,
+// объявляющие этот путь, а объявленный путь своего значения не меняет.
+// Поэтому символы путей, объявления которых могли измениться, очищаются
+// и восстанавливаются повторным анализом объявляющих их операторов без
+// вывода, а TOML-код генерируется заново только для разобранных операторов
+// и операторов, затрагивающих изменённые пути, в том числе через $[...].
+
+// Длина общего начала двух текстов
+static size_t commonPrefix(string_view a, string_view b) {
+    size_t n = min(a.size(), b.size());
+    size_t i = 0;
+    const size_t block = 4096;
+    while (i + block <= n && memcmp(a.data() + i, b.data() + i, block) == 0) i += block;
+    while (i < n && a[i] == b[i]) i++;
+    return i;
+}
+
+// Длина общего конца двух текстов, не больше limit
+static size_t commonSuffix(string_view a, string_view b, size_t limit) {
+    const char* x = a.data() + a.size();
+    const char* y = b.data() + b.size();
+    size_t i = 0;
+    const size_t block = 4096;
+    while (i + block <= limit && memcmp(x - i - block, y - i - block, block) == 0) i += block;
+    while (i < limit && x[-(ptrdiff_t)i - 1] == y[-(ptrdiff_t)i - 1]) i++;
+    return i;
+}
+
+// Подготовка сканера к разбору части [begin, end) текста в памяти. Таблицы
+// имён и чисел сохраняются: атомы AST совпадают с атомами таблицы путей.
+void Pipeline::scanRange(string_view text, size_t begin, size_t end) {
+    resetScanner();
+    input = text.substr(begin, end - begin);
+    inputBase = begin;
+    lexemeStart = begin;
+    inputEnded = true;
+}
+
+// Корневой путь и поддерево для путей, добавленных после прошлого вызова.
+// Путь интернируется после родителя, поэтому корень родителя уже известен.
+void Pipeline::indexPaths() {
+    for (size_t path = pathRoots.size(); path < paths.size(); path++) {
+        int parent = paths[path].first;
+        int root = parent <= 0 ? (int)path : pathRoots[parent];
+        pathRoots.push_back(root);
+        subtreeNext.push_back(-1);
+        if (root != (int)path) {
+            subtreeNext[path] = subtreeNext[root];
+            subtreeNext[root] = (int)path;
+        }
+    }
+}
+
+// Очистка символов корневого пути и его поддерева с сохранением для отката
+void Pipeline::rebuildRoot(int root) {
+    if (rootFlags[root] & ROOT_REBUILT) return;
+    if (!rootFlags[root]) markedRoots.push_back(root);
+    rootFlags[root] |= ROOT_REBUILT;
+    for (int path = root; path != -1; path = subtreeNext[path]) {
+        savedSymbols.push_back({ path, move(globalSymbols[path]) });
+        globalSymbols[path] = Symbol();
+    }
+}
+
+void Pipeline::markChanged(int root) {
+    rebuildRoot(root);
+    rootFlags[root] |= ROOT_CHANGED;
+}
+
+// Возврат очищенных символов после ошибки
+void Pipeline::restoreSymbols() {
+    for (auto& saved : savedSymbols) globalSymbols[saved.first] = move(saved.second);
+    savedSymbols.clear();
+}
+
+// Разбор и анализ оператора [begin, end) текста. TOML-код дописывается
+// в nextToml; при повторном анализе для восстановления символов вывод
+// отбрасывается.
+void Pipeline::analyzeRange(string_view text, size_t begin, size_t end, bool replay) {
+    scanRange(text, begin, end);
+    ASTNode* statement = Statement();
+    Emitter& emitter = documentWorker.emitter;
+    emitter.pathStack.clear();
+    size_t mark = nextToml.size();
+    replaying = replay;
+    semanticAnalysis(emitter, statement);
+    replaying = false;
+    emitter.out.flush();
+    if (replay) nextToml.resize(mark);
+    arena.reset();
+}
+
+// Забыть документ: следующее обновление преобразует текст целиком
+void Pipeline::dropDocument() {
+    documentReady = false;
+    documentStatements.clear();
+    documentRoots.clear();
+    documentText.clear();
+}
+
+// Замена элементов [first, first + count) вектора элементами source
+// с одним сдвигом хвоста
+template <class T>
+static void splice(vector<T>& target, size_t first, size_t count, const vector<T>& source) {
+    if (source.size() > count) {
+        target.insert(target.begin() + first + count, source.size() - count, T());
+    }
+    else {
+        target.erase(target.begin() + first + source.size(), target.begin() + first + count);
+    }
+    copy(source.begin(), source.end(), target.begin() + first);
+}
+
+void Pipeline::update(string_view text) {
+    DocumentChange& change = documentChange;
+    change = DocumentChange();
+    string_view newText = prepareText(text, updateText);
+
+    // Таблицы имён и путей только растут; когда они заметно больше, чем
+    // после полного преобразования, документ преобразуется заново
+    bool rebuild = !documentReady || paths.size() > 2 * builtPaths + 65536;
+    if (rebuild) {
+        dropDocument();
+        resetSemantics();
+        TI.clear();
+        TN.clear();
+    }
+    string_view oldText = documentText;
+    size_t n = documentStatements.size();
+    size_t prefix = 0;  // Длина общего начала прежнего и нового текста
+    size_t suffix = 0;  // Длина общего конца
+    size_t first = 0;   // Первый прежний оператор, разбираемый заново
+    size_t from = 0;    // Начало разбора в новом тексте
+    if (!rebuild) {
+        prefix = commonPrefix(oldText, newText);
+        if (prefix == oldText.size() && prefix == newText.size()) {
+            change.begin = change.end = change.oldEnd = documentToml.size();
+            return;
+        }
+        suffix = commonSuffix(oldText, newText, min(oldText.size(), newText.size()) - prefix);
+        // Оператор, закончившийся на первом изменённом байте, мог измениться:
+        // например, однострочный комментарий, к концу которого дописан текст
+        first = lower_bound(documentStatements.begin(), documentStatements.end(), prefix,
+            [](const DocumentStatement& statement, size_t offset) { return statement.end < offset; }) - documentStatements.begin();
+        from = first > 0 ? documentStatements[first - 1].end : 0;
+    }
+    size_t stable = oldText.size() - suffix;  // Прежний текст с этой позиции не изменился
+    long long delta = (long long)newText.size() - (long long)oldText.size();
+    size_t outputFrom = first < n ? documentStatements[first].output : documentToml.size();
+    if (rebuild) outputFrom = 0;
+    size_t resume = n;  // Первый прежний оператор после разобранных заново
+
+    insertedStatements.clear();
+    insertedRoots.clear();
+    nextToml.clear();
+    Emitter& emitter = documentWorker.emitter;
+    emitter.out.setString(&nextToml);
+
+    // Разбор изменённых операторов. При полном преобразовании каждый
+    // оператор сразу анализируется, как в S().
+    exception_ptr parseError;
+    scanRange(newText, from, newText.size());
+    lineIndex = (int)first + 1;
+    try {
+        if (from == 0 || currentValue() != "end") {
+            do {
+                ASTNode* statement = Statement();
+                DocumentStatement record;
+                record.end = consumedEnd;
+                record.output = outputFrom + nextToml.size();
+                record.roots = (uint32_t)insertedRoots.size();
+                collectPaths(statement);
+                record.written = (uint32_t)writtenPaths.size();
+                insertedRoots.insert(insertedRoots.end(), writtenPaths.begin(), writtenPaths.end());
+                insertedRoots.insert(insertedRoots.end(), readPaths.begin(), readPaths.end());
+                insertedStatements.push_back(record);
+                if (rebuild) {
+                    emitter.pathStack.clear();
+                    semanticAnalysis(emitter, statement);
+                    emitter.out.flush();
+                }
+                arena.reset();
+
+                long long oldEnd = (long long)record.end - delta;
+                if (!rebuild && oldEnd >= (long long)stable) {
+                    auto it = lower_bound(documentStatements.begin() + first, documentStatements.end(), (size_t)oldEnd,
+                        [](const DocumentStatement& statement, size_t offset) { return statement.end < offset; });
+                    if (it != documentStatements.end() && it->end == (size_t)oldEnd) {
+                        resume = it - documentStatements.begin() + 1;
+                        break;
+                    }
+                }
+            } while (currentValue() != "end");
+        }
+    }
+    catch (const ConversionError&) {
+        parseError = current_exception();
+    }
+    size_t m = insertedStatements.size();
+    change.parsed = m;
+    if (parseError) resume = n;
+
+    // Прежний TOML-код [outputFrom, replacedEnd) заменяется на nextToml
+    size_t replacedEnd = resume < n ? documentStatements[resume].output : documentToml.size();
+
+    if (rebuild) {
+        emitter.out.flush();
+        if (parseError) rethrow_exception(parseError);
+        documentStatements.swap(insertedStatements);
+        documentRoots.swap(insertedRoots);
+        builtPaths = paths.size();
+        indexPaths();
+        documentReady = true;
+        change.analyzed = m;
+    }
+    else {
+        auto rootsBegin = [&](size_t k) { return k < n ? documentStatements[k].roots : (uint32_t)documentRoots.size(); };
+
+        // Корневые пути, объявления которых могли измениться: объявленные
+        // удалёнными и новыми операторами, затем по цепочке объявленные
+        // прежними операторами, которые затрагивают уже изменённые пути.
+        // Пути, которые эти операторы читают, тоже восстанавливаются:
+        // константа могла быть объявлена только после них.
+        indexPaths();
+        rootFlags.resize(paths.size(), 0);
+        if (globalSymbols.size() < paths.size()) globalSymbols.resize(paths.size());
+        // После синтаксической ошибки прежние операторы не участвуют
+        // в результате: достаточно найти семантическую ошибку раньше неё
+        for (size_t k = first; k < resume && !parseError; k++) {
+            uint32_t begin = documentStatements[k].roots;
+            for (uint32_t r = begin; r < begin + documentStatements[k].written; r++) markChanged(documentRoots[r]);
+        }
+        for (size_t i = 0; i < m; i++) {
+            uint32_t begin = insertedStatements[i].roots;
+            uint32_t end = i + 1 < m ? insertedStatements[i + 1].roots : (uint32_t)insertedRoots.size();
+            for (uint32_t r = begin; r < end; r++) {
+                if (r < begin + insertedStatements[i].written) markChanged(insertedRoots[r]);
+                else rebuildRoot(insertedRoots[r]);
+            }
+        }
+        tailAffected.assign(n - resume, 0);
+        for (size_t k = resume; k < n; k++) {
+            uint32_t begin = documentStatements[k].roots;
+            uint32_t end = rootsBegin(k + 1);
+            bool affected = false;
+            for (uint32_t r = begin; r < end && !affected; r++) {
+                affected = (rootFlags[documentRoots[r]] & ROOT_CHANGED) != 0;
+            }
+            if (!affected) continue;
+            tailAffected[k - resume] = 1;
+            for (uint32_t r = begin; r < end; r++) {
+                if (r < begin + documentStatements[k].written) markChanged(documentRoots[r]);
+                else rebuildRoot(documentRoots[r]);
+            }
+        }
+
+        auto writesRebuilt = [&](size_t k) {
+            uint32_t begin = documentStatements[k].roots;
+            for (uint32_t r = begin; r < begin + documentStatements[k].written; r++) {
+                if (rootFlags[documentRoots[r]] & ROOT_REBUILT) return true;
+            }
+            return false;
+        };
+
+        // Анализ в порядке документа: восстановление очищенных символов
+        // прежними операторами и генерация TOML-кода изменённых. TOML-код
+        // прежних операторов между изменёнными переносится в nextToml,
+        // а после последнего изменённого остаётся на месте.
+        tailOutput.resize(n - resume);
+        try {
+            for (size_t k = 0; k < first; k++) {
+                if (!writesRebuilt(k)) continue;
+                analyzeRange(oldText, k > 0 ? documentStatements[k - 1].end : 0, documentStatements[k].end, true);
+                change.replayed++;
+            }
+            size_t begin = from;
+            for (size_t i = 0; i < m; i++) {
+                insertedStatements[i].output = outputFrom + nextToml.size();
+                analyzeRange(newText, begin, insertedStatements[i].end, false);
+                begin = insertedStatements[i].end;
+            }
+            change.analyzed = m;
+            if (parseError) rethrow_exception(parseError);
+
+            for (size_t k = resume; k < n; k++) {
+                size_t begin = documentStatements[k - 1].end + delta;
+                size_t end = documentStatements[k].end + delta;
+                size_t oldOutput = documentStatements[k].output;
+                tailOutput[k - resume] = outputFrom + nextToml.size() + (oldOutput - replacedEnd);
+                if (tailAffected[k - resume]) {
+                    nextToml.append(documentToml, replacedEnd, oldOutput - replacedEnd);
+                    analyzeRange(newText, begin, end, false);
+                    change.analyzed++;
+                    replacedEnd = k + 1 < n ? documentStatements[k + 1].output : documentToml.size();
+                }
+                else if (writesRebuilt(k)) {
+                    analyzeRange(newText, begin, end, true);
+                    change.replayed++;
+                }
+            }
+        }
+        catch (...) {
+            replaying = false;
+            emitter.out.flush();
+            restoreSymbols();
+            for (int root : markedRoots) rootFlags[root] = 0;
+            markedRoots.clear();
+            throw;
+        }
+        savedSymbols.clear();
+        for (int root : markedRoots) rootFlags[root] = 0;
+        markedRoots.clear();
+
+        // Новый список операторов: прежние до first, разобранные заново
+        // и прежние с resume со сдвинутыми позициями
+        uint32_t removedFrom = rootsBegin(first);
+        uint32_t removedRoots = rootsBegin(resume) - removedFrom;
+        long long rootsDelta = (long long)insertedRoots.size() - removedRoots;
+        for (DocumentStatement& record : insertedStatements) record.roots += removedFrom;
+        for (size_t k = resume; k < n; k++) {
+            DocumentStatement& record = documentStatements[k];
+            record.end += delta;
+            record.output = tailOutput[k - resume];
+            record.roots = (uint32_t)(record.roots + rootsDelta);
+        }
+        splice(documentRoots, removedFrom, removedRoots, insertedRoots);
+        splice(documentStatements, first, resume - first, insertedStatements);
+    }
+
+    // Изменённая часть TOML-кода
+    string_view oldToml = string_view(documentToml).substr(outputFrom, replacedEnd - outputFrom);
+    size_t same = commonPrefix(oldToml, nextToml);
+    size_t sameEnd = commonSuffix(oldToml, nextToml, min(oldToml.size(), nextToml.size()) - same);
+    change.begin = outputFrom + same;
+    change.end = outputFrom + nextToml.size() - sameEnd;
+    change.oldEnd = replacedEnd - sameEnd;
+    if (rebuild) {
+        documentToml.swap(nextToml);
+        documentText.assign(newText.data(), newText.size());
+        return;
+    }
+    // Запас ёмкости, чтобы вставка в середину не копировала весь текст заново
+    size_t tomlSize = documentToml.size() - (replacedEnd - outputFrom) + nextToml.size();
+    if (documentToml.capacity() < tomlSize) documentToml.reserve(tomlSize + tomlSize / 16);
+    documentToml.replace(outputFrom, replacedEnd - outputFrom, nextToml);
+    if (documentText.capacity() < newText.size()) documentText.reserve(newText.size() + newText.size() / 16);
+    documentText.replace(prefix, oldText.size() - prefix - suffix, newText.substr(prefix, newText.size() - prefix - suffix));
+}
+
+// ЗАПРОС ЗНАЧЕНИЙ
+// Значение пути ищется в операторах, объявляющих его корень, начиная
+// с последнего. Операторы находятся просмотром байтов, так же как границы
+// частей при параллельном разборе, а разбирается только оператор, где путь
+// найден, и операторы констант, на которые ссылается значение. Ссылка
+// разрешается к последнему значению имени перед ней в порядке
+// семантического анализа, в том числе к ключу того же словаря.
+
+// Границы, вид и корневые имена операторов верхнего уровня
+void Pipeline::indexStatements(string_view text) {
+    queryStatements.clear();
+    queryRoots.clear();
+    queryDefinitions.clear();
+    const char* data = text.data();
+    const char* end = data + text.size();
+    size_t n = text.size();
+    size_t begin = 0;
+    size_t depth = 0;
+    bool statementStart = true;
+    bool expectRoot = false;    // Следующее имя - корень: после set и ключ словаря верхнего уровня
+    bool assignment = false;
+    bool constant = false;
+    bool dictionary = false;
+    uint32_t keys = 0;          // Номер следующего ключа верхнего уровня словаря
+
+    auto addRoot = [&](string_view name) {
+        vector<uint32_t>& list = queryRoots[name];
+        uint32_t index = (uint32_t)queryStatements.size();
+        if (list.empty() || list.back() != index) list.push_back(index);
+    };
+    auto addDefinition = [&](string_view name, uint32_t position) {
+        queryDefinitions[name].push_back({ (uint32_t)queryStatements.size(), position });
+    };
+    auto finish = [&](size_t at) {
+        queryStatements.push_back({ begin, at, assignment, constant });
+        begin = at;
+        statementStart = true;
+        assignment = constant = dictionary = expectRoot = false;
+        keys = 0;
+    };
+    // Начало значения ключа "имя: значение", начиная с позиции за именем
+    // (n - значения нет); пробелы и комментарии пропускаются
+    auto valueStart = [&](size_t at) {
+        bool colon = false;
+        while (at < n) {
+            if (hasClass(text[at], CC_SPACE)) {
+                at++;
+            }
+            else if (text[at] == '-' && at + 1 < n && text[at + 1] == '-') {
+                const char* newline = findByte(data + at + 2, end, '\n');
+                at = newline == end ? n : newline - data + 1;
+            }
+            else if (text[at] == '%' && at + 1 < n && text[at + 1] == '{') {
+                const char* close = findPair(data + at + 1, end, '%', '}');
+                at = close == end ? n : close - data + 2;
+            }
+            else if (text[at] == ':' && !colon) {
+                colon = true;
+                at++;
+            }
+            else {
+                return colon ? at : n;
+            }
+        }
+        return n;
+    };
+
+    size_t i = 0;
+    while (i < n) {
+        char c = text[i];
+        if (hasClass(c, CC_SPACE)) {
+            i++;
+            continue;
+        }
+        if (c == '"') {
+            const char* quote = findByte(data + i + 1, end, '"');
+            if (quote == end) break;
+            i = quote - data + 1;
+            statementStart = false;
+        }
+        else if (c == '%' && i + 1 < n && text[i + 1] == '{') {
+            const char* close = findPair(data + i + 1, end, '%', '}');
+            if (close == end) break;
+            i = close - data + 2;
+            if (depth == 0) finish(i);
+        }
+        else if (c == '-' && i + 1 < n && text[i + 1] == '-') {
+            const char* newline = findByte(data + i + 2, end, '\n');
+            i = newline == end ? n : newline - data + 1;
+            if (depth == 0) finish(i);
+        }
+        else if (c == '{') {
+            if (depth == 0 && statementStart) dictionary = true;
+            depth++;
+            i++;
+            statementStart = false;
+            expectRoot = dictionary && depth == 1;
+        }
+        else if (c == '}') {
+            i++;
+            statementStart = false;
+            if (depth > 0 && --depth == 0 && dictionary) finish(i);
+        }
+        else if (c == ';') {
+            i++;
+            statementStart = false;
+            if (depth == 0) finish(i);
+            else expectRoot = dictionary && depth == 1;
+        }
+        else if (hasClass(c, CC_ALPHA) || (unsigned char)c >= 0x80) {
+            // Байты вне ASCII считаются частью имени: проверяет их сканер
+            size_t wordEnd = i + 1;
+            while (wordEnd < n && (hasClass(text[wordEnd], CC_IDENT) || (unsigned char)text[wordEnd] >= 0x80)) wordEnd++;
+            string_view word = text.substr(i, wordEnd - i);
+            if (statementStart) {
+                // Разбор заканчивается на "end" в начале оператора
+                if (word == "end") break;
+                if (word == "set") {
+                    expectRoot = constant = true;
+                }
+                else {
+                    assignment = true;
+                    addRoot(word);
+                    addDefinition(word, 0);
+                }
+            }
+            else if (expectRoot) {
+                addRoot(word);
+                if (!dictionary) {
+                    addDefinition(word, 0);
+                }
+                else {
+                    // Ключ со значением-словарём объявляет только вложенные пути
+                    size_t value = valueStart(wordEnd);
+                    if (value == n || text[value] != '{') addDefinition(word, keys);
+                    keys++;
+                }
+                expectRoot = false;
+            }
+            i = wordEnd;
+            statementStart = false;
+        }
+        else {
+            i++;
+            statementStart = false;
+            expectRoot = false;
+        }
+    }
+}
+
+// Разбор оператора index; AST действителен до следующего разбора
+ASTNode* Pipeline::parseStatement(uint32_t index) {
+    scanRange(queryText, queryStatements[index].begin, queryStatements[index].end);
+    return Statement();
+}
+
+// Значение символа atom, заданное оператором в позиции position
+// (nullptr - не задано)
+ASTNode* Pipeline::rootValue(ASTNode* statement, int atom, uint32_t position) {
+    if (statement->kind == N_TRANSLATION || statement->kind == N_ASSIGNMENT) {
+        return statement->left->atom == atom ? statement->right : nullptr;
+    }
+    if (statement->kind != N_DICTIONARY) return nullptr;
+    ASTNode* key = statement->left;
+    for (uint32_t k = 0; key && k < position; k++) key = key->next;
+    if (!key || key->atom != atom || !key->right || key->right->kind == N_DICTIONARY) return nullptr;
+    return key->right;
+}
+
+// Значение символа atom для ссылки из позиции position оператора statement
+// (nullptr - нет). Значение задают set и ключи словарей; присваивание
+// только объявляет переменную, если символ ещё не объявлен.
+const QueryDefinition* Pipeline::constantDefinition(int atom, uint32_t statement, uint32_t position) {
+    auto it = queryDefinitions.find(TI.name(atom));
+    if (it == queryDefinitions.end()) return nullptr;
+    const vector<QueryDefinition>& list = it->second;
+    const QueryDefinition* assignment = nullptr;
+    for (auto p = lower_bound(list.begin(), list.end(), QueryDefinition{ statement, position }); p != list.begin();) {
+        --p;
+        if (!queryStatements[p->statement].assignment) return &*p;
+        assignment = &*p;
+    }
+    return assignment;
+}
+
+// Позиция ссылок в значении, заданном definition: set видит своё имя,
+// ключ словаря - только предыдущие ключи
+static uint32_t referencePosition(const QueryStatement& statement, const QueryDefinition& definition) {
+    return statement.constant ? 1 : definition.position;
+}
+
+static uint64_t constantKey(uint64_t statement, int atom) {
+    return statement << 32 | (uint32_t)atom;
+}
+
+// Ссылки $[...] в значении из позиции position оператора statement
+// добавляются в queryWork
+void Pipeline::collectReferences(ASTNode* value, uint32_t statement, uint32_t position) {
+    queryNodes.assign(1, value);
+    while (!queryNodes.empty()) {
+        ASTNode* node = queryNodes.back();
+        queryNodes.pop_back();
+        if (node->kind == N_REFERENCE) queryWork.push_back({ node->atom, statement, position });
+        if (node->next) queryNodes.push_back(node->next);
+        if (node->right) queryNodes.push_back(node->right);
+        if (node->left) queryNodes.push_back(node->left);
+    }
+}
+
+// Вычисление констант, на которые ссылаются операторы из queryWork.
+// Ссылка ведёт только к значению выше неё, поэтому сначала собираются все
+// нужные значения, а затем константы вычисляются в порядке семантического
+// анализа, когда значения, нужные каждой из них, уже известны.
+void Pipeline::resolveConstants() {
+    queryPending.clear();
+    while (!queryWork.empty()) {
+        QueryReference reference = queryWork.back();
+        queryWork.pop_back();
+        int atom = reference.atom;
+        const QueryDefinition* definition = constantDefinition(atom, reference.statement, reference.position);
+        if (!definition) semanticError("Константа '" + TI.name(atom) + "' не определена");
+        const QueryStatement& statement = queryStatements[definition->statement];
+        // "set r = $[r]": константа объявлена до вычисления значения
+        if (definition->statement == reference.statement && statement.constant) continue;
+        uint64_t key = constantKey(definition->statement, atom);
+        if (queryConstants.count(key)) continue;
+        if (statement.assignment) {
+            queryConstants[key] = varMarker;
+            continue;
+        }
+        queryConstants[key] = nullptr;
+        queryPending.push_back({ atom, definition->statement, definition->position });
+        ASTNode* value = rootValue(parseStatement(definition->statement), atom, definition->position);
+        if (!value) semanticError("Константа '" + TI.name(atom) + "' не определена");
+        collectReferences(value, definition->statement, referencePosition(statement, *definition));
+    }
+    sort(queryPending.begin(), queryPending.end(), [](const QueryReference& a, const QueryReference& b) {
+        return QueryDefinition{ a.statement, a.position } < QueryDefinition{ b.statement, b.position };
+    });
+    for (const QueryReference& pending : queryPending) {
+        QueryDefinition definition = { pending.statement, pending.position };
+        ASTNode* value = rootValue(parseStatement(pending.statement), pending.atom, pending.position);
+        queryConstants[constantKey(pending.statement, pending.atom)] =
+            queryValueOf(value, pending.statement, referencePosition(queryStatements[pending.statement], definition));
+    }
+}
+
+// Значение константы atom для ссылки из позиции position оператора
+// statement; константа должна быть уже вычислена resolveConstants()
+const ConstantRef& Pipeline::resolvedConstant(int atom, uint32_t statement, uint32_t position) {
+    const QueryDefinition* definition = constantDefinition(atom, statement, position);
+    if (definition->statement == statement && queryStatements[statement].constant) return constMarker;
+    return queryConstants[constantKey(definition->statement, atom)];
+}
+
+ConstantRef Pipeline::queryScalar(ASTNode* value, uint32_t statement, uint32_t position) {
+    if (value->kind == N_REFERENCE) {
+        return resolvedConstant(value->atom, statement, position);
+    }
+    if (value->kind == N_STRING) {
+        return make_shared<const ConstantValue>("\"" + string(nodeValue(value)) + "\"");
+    }
+    return make_shared<const ConstantValue>(string(nodeValue(value)));
+}
+
+// Поиск значения пути path в операторе index. Ключи словарей с одинаковыми
+// именами допускаются и просматриваются с последнего, как последнее
+// присваивание при преобразовании. Остаток пути за ссылкой ищется в значении
+// константы. При collect ссылки на пути только собираются в queryWork для
+// resolveConstants(), и результат пуст.
+ConstantRef Pipeline::findValue(ASTNode* statement, const vector<int>& path, uint32_t index, bool collect) {
+    querySearch.clear();
+    if (statement->kind == N_TRANSLATION || statement->kind == N_ASSIGNMENT) {
+        if (statement->left->atom == path[0] && statement->right) querySearch.push_back({ statement->right, 1, 1 });
+    }
+    else if (statement->kind == N_DICTIONARY) {
+        uint32_t position = 0;
+        for (ASTNode* key = statement->left; key; key = key->next, position++) {
+            if (key->atom == path[0] && key->right) querySearch.push_back({ key->right, 1, position });
+        }
+    }
+    while (!querySearch.empty()) {
+        QuerySearchFrame frame = querySearch.back();
+        ASTNode* node = frame.node;
+        size_t depth = frame.depth;
+        querySearch.pop_back();
+        if (node->kind == N_REFERENCE) {
+            if (collect) {
+                queryWork.push_back({ node->atom, index, frame.position });
+                continue;
+            }
+            ConstantRef found = findInConstant(resolvedConstant(node->atom, index, frame.position), path, depth);
+            if (found) return found;
+            continue;
+        }
+        if (depth == path.size()) {
+            // Путь найден; ключи выше по тексту уже не нужны
+            if (!collect) return queryValueOf(node, index, frame.position);
+            collectReferences(node, index, frame.position);
+            return nullptr;
+        }
+        if (node->kind != N_DICTIONARY) continue;
+        for (ASTNode* key = node->left; key; key = key->next) {
+            if (key->atom == path[depth] && key->right) querySearch.push_back({ key->right, depth + 1, frame.position });
+        }
+    }
+    return nullptr;
+}
+
+// Поиск остатка пути path, начиная с сегмента depth, в значении константы
+ConstantRef Pipeline::findInConstant(const ConstantRef& value, const vector<int>& path, size_t depth) {
+    constantSearch.assign(1, { &value, depth });
+    while (!constantSearch.empty()) {
+        const ConstantRef& node = *constantSearch.back().first;
+        size_t at = constantSearch.back().second;
+        constantSearch.pop_back();
+        if (at == path.size()) return node;
+        if (!node->dictionary) continue;
+        for (const auto& key : node->keys) {
+            if (key.first == path[at]) constantSearch.push_back({ &key.second, at + 1 });
+        }
+    }
+    return nullptr;
+}
+
+// Значение узла из позиции position оператора statement; словарь
+// собирается без рекурсии
+ConstantRef Pipeline::queryValueOf(ASTNode* value, uint32_t statement, uint32_t position) {
+    if (value->kind != N_DICTIONARY) return queryScalar(value, statement, position);
+    auto dictionary = make_shared<ConstantValue>();
+    queryFrames.clear();
+    queryFrames.push_back({ value->left, 0, dictionary.get() });
+    while (!queryFrames.empty()) {
+        DictionaryFrame& frame = queryFrames.back();
+        ASTNode* node = frame.key;
+        if (!node) {
+            queryFrames.pop_back();
+            continue;
+        }
+        frame.key = node->next;
+        if (!node->right) continue;
+        if (node->right->kind == N_DICTIONARY) {
+            auto nested = make_shared<ConstantValue>();
+            ConstantValue* target = nested.get();
+            frame.constant->keys.push_back({ node->atom, move(nested) });
+            queryFrames.push_back({ node->right->left, 0, target });
+            continue;
+        }
+        frame.constant->keys.push_back({ node->atom, queryScalar(node->right, statement, position) });
+    }
+    return dictionary;
+}
+
+// Проверка операторов, от которых зависят значения путей keys: операторы,
+// объявляющие корни путей, и, до замыкания, операторы, объявляющие корни,
+// которые уже выбранные операторы объявляют или читают через $[...].
+// Они анализируются в порядке текста, как при преобразовании, и дают те же
+// ошибки (повторное объявление, неопределённая константа); TOML-код
+// отбрасывается.
+void Pipeline::checkStatements(const vector<string>& keys) {
+    queryChecked.assign(queryStatements.size(), false);
+    queryCheckedRoots.clear();
+    queryCheckRoots.clear();
+    auto addRoot = [&](int path) {
+        if (queryCheckedRoots.size() <= (size_t)path) queryCheckedRoots.resize(path + 1, false);
+        if (queryCheckedRoots[path]) return;
+        queryCheckedRoots[path] = true;
+        queryCheckRoots.push_back(path);
+    };
+    for (const string& key : keys) {
+        string_view root = string_view(key).substr(0, key.find('.'));
+        if (queryRoots.count(root)) addRoot(pathOf(0, TI.intern(root)));
+    }
+    for (size_t r = 0; r < queryCheckRoots.size(); r++) {
+        auto it = queryRoots.find(TI.name(paths[queryCheckRoots[r]].second));
+        if (it == queryRoots.end()) continue;
+        for (uint32_t index : it->second) {
+            if (queryChecked[index]) continue;
+            queryChecked[index] = true;
+            collectPaths(parseStatement(index));
+            for (int path : writtenPaths) addRoot(path);
+            for (int path : readPaths) addRoot(path);
+        }
+    }
+
+    Emitter& emitter = queryWorker.emitter;
+    emitter.out.discard();
+    for (uint32_t index = 0; index < queryStatements.size(); index++) {
+        if (!queryChecked[index]) continue;
+        emitter.pathStack.clear();
+        semanticAnalysis(emitter, parseStatement(index));
+    }
+    emitter.out.flush();
+}
+
+// Тип и значение скаляра по его TOML-коду, как в CompiledWriter::value:
+// числа записаны в каноническом виде и восстанавливаются точно
+static void setQueryType(QueryValue& value) {
+    const string& toml = value.toml;
+    if (!toml.empty() && toml[0] == '"') {
+        value.type = QUERY_STRING;
+    }
+    else if (toml == "true" || toml == "false") {
+        value.type = QUERY_BOOLEAN;
+        value.integer = toml == "true";
+    }
+    else {
+        const char* end = toml.data() + toml.size();
+        from_chars_result parsed = from_chars(toml.data(), end, value.integer);
+        value.type = QUERY_INTEGER;
+        if (parsed.ec != errc() || parsed.ptr != end) {
+            value.type = QUERY_FLOAT;
+            value.integer = 0;
+            from_chars(toml.data(), end, value.number);
+        }
+    }
+}
+
+void Pipeline::query(string_view text, const vector<string>& keys, vector<QueryValue>& values) {
+    resetParser();
+    resetSemantics();
+    queryText = prepareText(text, queryStorage);
+    indexStatements(queryText);
+    queryConstants.clear();
+    queryWork.clear();
+    values.assign(keys.size(), QueryValue());
+    checkStatements(keys);
+
+    vector<int> path;
+    for (size_t k = 0; k < keys.size(); k++) {
+        path.clear();
+        string_view rest = keys[k];
+        string_view root = rest.substr(0, rest.find('.'));
+        while (true) {
+            size_t dot = rest.find('.');
+            path.push_back(TI.intern(rest.substr(0, dot)));
+            if (dot == string_view::npos) break;
+            rest.remove_prefix(dot + 1);
+        }
+        auto it = queryRoots.find(root);
+        if (it == queryRoots.end()) continue;
+
+        // Ссылки, нужные значению, разрешаются до его сборки; разбор
+        // констант сбрасывает арену, и оператор разбирается повторно
+        ConstantRef found;
+        const vector<uint32_t>& statements = it->second;
+        for (size_t c = statements.size(); c-- > 0 && !found;) {
+            uint32_t index = statements[c];
+            ASTNode* statement = parseStatement(index);
+            findValue(statement, path, index, true);
+            if (!queryWork.empty()) {
+                resolveConstants();
+                statement = parseStatement(index);
+            }
+            found = findValue(statement, path, index, false);
+        }
+        if (!found) continue;
+
+        QueryValue& result = values[k];
+        result.found = true;
+        result.type = QUERY_TABLE;
+        if (found->dictionary) {
+            OutputBuffer out(-1, 4096);
+            out.setString(&result.toml);
+            Emitter emitter(out);
+            emitter.pathStack = path;
+            writeDictionary(emitter, *found, 0);
+            out.flush();
+        }
+        else {
+            result.toml = found->text;
+            setQueryType(result);
+        }
+    }
+}
+
+Converter::Converter(const ConverterOptions& options) : pipeline(new Pipeline(options)) {}
+
+Converter::~Converter() = default;
+
+const ConverterOptions& Converter::options() const {
+    return pipeline->options;
+}
+
+void Converter::setOptions(const ConverterOptions& options) {
+    pipeline->options = options;
+}
+
+// Запуск преобразования с перехватом ошибок
+template <class Start>
+static ConversionResult runConversion(Pipeline& pipeline, Start start) {
+    ConversionResult result;
+    StageTimer timer(pipeline.options.stats);
+    try {
+        start();
+        pipeline.run();
+        result.success = true;
+    }
+    catch (const ConversionError& e) {
+        result.diagnostic = e.what();
+    }
+    pipeline.tomlOutput.flush();
+    if (result.success && pipeline.tomlOutput.error()) {
+        result.success = false;
+        result.diagnostic = outputErrorMessage(pipeline.tomlOutput.error());
+    }
+    if (pipeline.collectStats) pipeline.totalSeconds = timer.seconds();
+    return result;
+}
+
+ConversionResult Converter::convert(istream& input) {
+    string toml;
+    pipeline->tomlOutput.setString(&toml);
+    ConversionResult result = runConversion(*pipeline, [&] { pipeline->reset(input); });
+    pipeline->tomlOutput.setString(nullptr);
+    result.toml = move(toml);
+    return result;
+}
+
+ConversionResult Converter::convert(istream& input, int fd) {
+    pipeline->tomlOutput.setFd(fd);
+    return runConversion(*pipeline, [&] { pipeline->reset(input); });
+}
+
+ConversionResult Converter::convert(string_view text) {
+    string toml;
+    pipeline->tomlOutput.setString(&toml);
+    ConversionResult result = runConversion(*pipeline, [&] { pipeline->reset(text); });
+    pipeline->tomlOutput.setString(nullptr);
+    result.toml = move(toml);
+    return result;
+}
+
+ConversionResult Converter::convert(string_view text, int fd) {
+    pipeline->tomlOutput.setFd(fd);
+    return runConversion(*pipeline, [&] { pipeline->reset(text); });
+}
+
+ConversionResult Converter::compile(string_view text, CompiledWriter& writer) {
+    writer.clear();
+    // TOML-код не нужен: вывод отбрасывается
+    pipeline->tomlOutput.discard();
+    pipeline->compileTo(&writer);
+    ConversionResult result = runConversion(*pipeline, [&] { pipeline->reset(text); });
+    pipeline->compileTo(nullptr);
+    return result;
+}
+
+QueryResult Converter::query(string_view text, const vector<string>& paths) {
+    QueryResult result;
+    try {
+        pipeline->query(text, paths, result.values);
+        result.success = true;
+    }
+    catch (const ConversionError& e) {
+        result.values.clear();
+        result.diagnostic = e.what();
+    }
+    return result;
+}
+
+ConversionResult Converter::runStage(string_view text, ConversionStage stage) {
+    pipeline->tomlOutput.discard();
+    pipeline->stage = stage;
+    ConversionResult result = runConversion(*pipeline, [&] { pipeline->reset(text); });
+    pipeline->stage = ConversionStage::Analyze;
+    return result;
+}
+
+const ConversionCounters& Converter::counters() const {
+    return pipeline->counters;
+}
+
+ConversionStats Converter::stats() const {
+    const Pipeline& p = *pipeline;
+    ConversionStats result;
+    result.scannerSeconds = p.scannerSeconds;
+    result.parserSeconds = p.parserSeconds;
+    result.semanticSeconds = p.semanticSeconds;
+    result.outputSeconds = p.outputStats.seconds;
+    result.totalSeconds = p.totalSeconds;
+    result.inputBytes = p.inputSize();
+    result.outputBytes = (size_t)p.outputStats.bytes;
+    result.statements = p.counters.statements;
+    for (size_t type = 1; type < p.tokenTypeCounts.size(); type++) {
+        result.tokens.push_back({ tokenTypeNames[type], p.tokenTypeCounts[type] });
+    }
+    for (size_t kind = 0; kind < p.nodeKindCounts.size(); kind++) {
+        result.nodes.push_back({ nodeKindNames[kind], p.nodeKindCounts[kind] });
+    }
+    result.symbols = p.symbolCount();
+    result.paths = p.pathCount();
+    result.symbolLookups = p.symbolLookups;
+    result.constantLookups = p.constantLookups;
+    return result;
+}
+
+IncrementalConverter::IncrementalConverter(const ConverterOptions& options) : pipeline(new Pipeline(options)) {
+    pipeline->options.tokenDump = nullptr;
+    pipeline->options.astDump = nullptr;
+}
+
+IncrementalConverter::~IncrementalConverter() = default;
+
+ConversionResult IncrementalConverter::update(string_view text) {
+    ConversionResult result;
+    try {
+        pipeline->update(text);
+        result.success = true;
+    }
+    catch (const ConversionError& e) {
+        pipeline->documentChange = DocumentChange();
+        result.diagnostic = e.what();
+    }
+    return result;
+}
+
+const string& IncrementalConverter::toml() const {
+    return pipeline->documentToml;
+}
+
+const DocumentChange& IncrementalConverter::lastChange() const {
+    return pipeline->documentChange;
+}
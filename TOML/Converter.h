@@ -0,0 +1,197 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// БИБЛИОТЕКА ПРЕОБРАЗОВАНИЯ В TOML
+// Сканер, синтаксический и семантический анализаторы и генератор TOML
+// собраны в объект Converter без глобального состояния. Независимые
+// объекты можно использовать одновременно из разных потоков; один объект
+// повторно использует свои буферы при последовательных преобразованиях.
+
+// Формат печати токенов и AST
+enum class DumpFormat {
+    Text,       // Построчно с отступами, для чтения
+    JsonLines   // Один объект JSON на строку, для обработки программами
+};
+
+// Параметры преобразования
+struct ConverterOptions {
+    size_t maxDepth = SIZE_MAX;             // Максимальная глубина вложенности словарей
+    unsigned threads = 1;                   // Потоки разбора текста в памяти (1 - последовательно)
+    std::ostream* tokenDump = nullptr;      // Печать токенов (nullptr - не печатать)
+    std::ostream* astDump = nullptr;        // Печать AST операторов (nullptr - не печатать)
+    DumpFormat dumpFormat = DumpFormat::Text;
+    bool stats = false;                     // Замер времени этапов и счёт обращений к символам
+    // Комментарии пропускаются сканером без токенов и узлов AST и не
+    // попадают в вывод; номера операторов в сообщениях об ошибках
+    // считаются без комментариев
+    bool stripComments = false;
+};
+
+// Результат преобразования
+struct ConversionResult {
+    bool success = false;
+    std::string toml;        // TOML-код, если вывод не направлен в дескриптор
+    std::string diagnostic;  // Сообщение об ошибке, если success == false
+};
+
+// Тип значения, найденного запросом
+enum QueryType : uint8_t {
+    QUERY_TABLE = 0,        // Словарь; toml - его таблицы, как при преобразовании
+    QUERY_STRING = 1,       // Строка; toml - в кавычках, как в TOML
+    QUERY_INTEGER = 2,      // Целое int64
+    QUERY_FLOAT = 3,        // Число double, включая inf и nan
+    QUERY_BOOLEAN = 4       // true или false
+};
+
+// Значение, найденное запросом
+struct QueryValue {
+    bool found = false;
+    QueryType type = QUERY_TABLE;
+    std::string toml;       // TOML-код значения
+    int64_t integer = 0;    // Значение QUERY_INTEGER и QUERY_BOOLEAN
+    double number = 0;      // Значение QUERY_FLOAT
+};
+
+// Результат запроса: значения в порядке путей запроса
+struct QueryResult {
+    bool success = false;
+    std::vector<QueryValue> values;
+    std::string diagnostic;  // Сообщение об ошибке, если success == false
+};
+
+// Этапы конвейера для раздельного измерения
+enum class ConversionStage {
+    Scan,       // Только лексический анализ
+    Parse,      // Лексический и синтаксический анализ
+    Analyze     // Полное преобразование
+};
+
+// Счётчики работы конвейера за последнее преобразование
+struct ConversionCounters {
+    size_t tokens = 0;      // Выделенные токены
+    size_t nodes = 0;       // Созданные узлы AST
+    size_t statements = 0;  // Разобранные операторы верхнего уровня
+};
+
+// Статистика последнего преобразования. Количества токенов и узлов
+// считаются всегда, время этапов и обращения к таблице символов -
+// только при options.stats. При разборе по частям время сканера и
+// синтаксического анализа - сумма по потокам.
+struct ConversionStats {
+    double scannerSeconds = 0;      // Сканер
+    double parserSeconds = 0;       // Синтаксический анализ S() без сканера
+    double semanticSeconds = 0;     // semanticAnalysis без записи вывода
+    double outputSeconds = 0;       // Запись TOML-кода в дескриптор или строку
+    double totalSeconds = 0;
+    size_t inputBytes = 0;
+    size_t outputBytes = 0;
+    size_t statements = 0;
+    std::vector<std::pair<std::string_view, size_t>> tokens;  // Токены по типам
+    std::vector<std::pair<std::string_view, size_t>> nodes;   // Узлы AST по видам
+    size_t symbols = 0;             // Записи globalSymbols
+    size_t paths = 0;               // Интернированные пути
+    size_t symbolLookups = 0;       // Обращения к globalSymbols
+    size_t constantLookups = 0;     // Разрешения ссылок $[...]
+};
+
+// Версия генерируемого TOML-кода. Увеличивается при каждом изменении
+// результата преобразования, чтобы кэш не выдавал результаты прежних версий.
+constexpr unsigned CONVERTER_VERSION = 4;
+
+class Pipeline;
+class CompiledWriter;
+
+class Converter {
+public:
+    explicit Converter(const ConverterOptions& options = ConverterOptions());
+    ~Converter();
+
+    Converter(const Converter&) = delete;
+    Converter& operator=(const Converter&) = delete;
+
+    // Преобразование потока до конца или до строки "exit".
+    // TOML-код собирается в result.toml.
+    ConversionResult convert(std::istream& input);
+
+    // То же, но TOML-код по мере анализа пишется в дескриптор fd.
+    // При ошибке в fd остаётся TOML-код операторов, разобранных до неё.
+    ConversionResult convert(std::istream& input, int fd);
+
+    // Преобразование текста в памяти. При options.threads > 1 и выключенной
+    // печати токенов и AST текст разбирается по частям несколькими потоками.
+    ConversionResult convert(std::string_view text);
+    ConversionResult convert(std::string_view text, int fd);
+
+    // Преобразование текста со сборкой скомпилированного документа
+    // (Compiled.h) вместо вывода TOML-кода. Выполняется последовательно.
+    ConversionResult compile(std::string_view text, CompiledWriter& writer);
+
+    // Значения ключей по полным путям через точку без преобразования всего
+    // текста. Операторы верхнего уровня находятся по скобкам и разделителям
+    // без разбора; разбираются только операторы, объявляющие корни путей,
+    // и константы, на которые ссылаются найденные значения. Для ключа,
+    // которому значение присваивалось несколько раз, - последнее значение.
+    // Эти операторы и операторы, объявляющие имена, которые они объявляют
+    // или читают, проходят семантический анализ, как при преобразовании;
+    // ошибки в остальных операторах не обнаруживаются.
+    QueryResult query(std::string_view text, const std::vector<std::string>& paths);
+
+    // Последовательная обработка текста до этапа stage включительно;
+    // TOML-код отбрасывается. Этапы измеряются по разности времени.
+    ConversionResult runStage(std::string_view text, ConversionStage stage);
+
+    const ConversionCounters& counters() const;
+    ConversionStats stats() const;
+
+    const ConverterOptions& options() const;
+    void setOptions(const ConverterOptions& options);
+
+private:
+    std::unique_ptr<Pipeline> pipeline;
+};
+
+// Изменение TOML-кода документа при обновлении: байты [begin, end) нового
+// кода заменили байты [begin, oldEnd) прежнего, остальные не изменились
+struct DocumentChange {
+    size_t begin = 0;
+    size_t end = 0;
+    size_t oldEnd = 0;
+    size_t parsed = 0;      // Операторы, разобранные по изменённому тексту
+    size_t analyzed = 0;    // Операторы, TOML-код которых сгенерирован заново
+    size_t replayed = 0;    // Прежние операторы, повторно проанализированные без вывода
+};
+
+// ИНКРЕМЕНТАЛЬНОЕ ПРЕОБРАЗОВАНИЕ
+// Объект хранит последнюю успешно преобразованную версию документа: текст,
+// границы и корневые пути операторов верхнего уровня и TOML-код каждого.
+// При обновлении заново разбираются только операторы, затронутые изменением
+// текста, а TOML-код генерируется для них и для операторов, зависящих от них
+// через общие корневые пути, в том числе ссылки $[...] на изменённые константы.
+// Токены и AST не печатаются, options.threads не используется.
+class IncrementalConverter {
+public:
+    explicit IncrementalConverter(const ConverterOptions& options = ConverterOptions());
+    ~IncrementalConverter();
+
+    IncrementalConverter(const IncrementalConverter&) = delete;
+    IncrementalConverter& operator=(const IncrementalConverter&) = delete;
+
+    // Преобразование новой версии текста. Первый вызов преобразует текст
+    // целиком. result.toml не заполняется: весь TOML-код возвращает toml(),
+    // изменённую часть - lastChange(). При ошибке документ остаётся
+    // в последней успешной версии, и следующая сравнивается с ней.
+    ConversionResult update(std::string_view text);
+
+    const std::string& toml() const;
+    const DocumentChange& lastChange() const;
+
+private:
+    std::unique_ptr<Pipeline> pipeline;
+};
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+
+#include <fcntl.h>
+
+#ifdef _WIN32
+#include <io.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#endif
+
+// Счётчики вывода для статистики преобразования
+struct OutputStats {
+    uint64_t bytes = 0;     // Выведенные байты
+    double seconds = 0;     // Время записи в дескриптор или строку
+};
+
+// БУФЕРИЗОВАННЫЙ ВЫВОД В ФАЙЛОВЫЙ ДЕСКРИПТОР
+// Текст накапливается в большом буфере и сбрасывается в дескриптор целиком,
+// поэтому запись отдельных фрагментов не требует выделения памяти.
+// Первая ошибка записи запоминается (error), последующий вывод
+// отбрасывается; проверять её нужно после последнего flush.
+class OutputBuffer {
+public:
+    explicit OutputBuffer(int fd = 1, size_t capacity = 1 << 20)
+        : fd(fd), capacity(capacity), data(new char[capacity]) {}
+
+    OutputBuffer(const OutputBuffer&) = delete;
+    OutputBuffer& operator=(const OutputBuffer&) = delete;
+
+    ~OutputBuffer() {
+        flush();
+    }
+
+    void write(std::string_view text) {
+        if (text.size() > capacity - used) {
+            flush();
+            // Фрагменты больше буфера пишутся напрямую
+            if (text.size() >= capacity) {
+                emit(text.data(), text.size());
+                return;
+            }
+        }
+        memcpy(data.get() + used, text.data(), text.size());
+        used += text.size();
+    }
+
+    void put(char c) {
+        if (used == capacity) flush();
+        data[used++] = c;
+    }
+
+    void flush() {
+        if (used == 0) return;
+        emit(data.get(), used);
+        used = 0;
+    }
+
+    // Смена дескриптора; накопленный текст сбрасывается в прежний,
+    // ошибка прежнего вывода забывается
+    void setFd(int newFd) {
+        flush();
+        fd = newFd;
+        sink = nullptr;
+        discarding = false;
+        failure = 0;
+    }
+
+    // Вывод в строку target вместо дескриптора
+    void setString(std::string* target) {
+        flush();
+        sink = target;
+        discarding = false;
+        failure = 0;
+    }
+
+    // Вывод отбрасывается (учитывается только в статистике)
+    void discard() {
+        flush();
+        sink = nullptr;
+        discarding = true;
+        failure = 0;
+    }
+
+    int descriptor() const {
+        return fd;
+    }
+
+    // Код errno первой неудачной записи в дескриптор; 0 - ошибок не было
+    int error() const {
+        return failure;
+    }
+
+    // Учёт выведенных байтов и времени записи (nullptr - не учитывать)
+    void setStats(OutputStats* target) {
+        stats = target;
+    }
+
+private:
+    void emit(const char* text, size_t size) {
+        auto start = stats ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+        if (sink) sink->append(text, size);
+        else if (!discarding && failure == 0) writeAll(text, size);
+        if (stats) {
+            stats->bytes += size;
+            stats->seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+    }
+
+    void writeAll(const char* text, size_t size) {
+        while (size > 0) {
+#ifdef _WIN32
+            int chunk = _write(fd, text, (unsigned)(size > (1u << 30) ? (1u << 30) : size));
+#else
+            ssize_t chunk = ::write(fd, text, size);
+#endif
+            if (chunk < 0 && errno == EINTR) continue;
+            if (chunk <= 0) {
+                failure = chunk < 0 ? errno : EIO;
+                return;
+            }
+            text += chunk;
+            size -= (size_t)chunk;
+        }
+    }
+
+    int fd;
+    std::string* sink = nullptr;  // Строка, принимающая вывод вместо дескриптора
+    bool discarding = false;
+    int failure = 0;
+    OutputStats* stats = nullptr;
+    size_t capacity;
+    size_t used = 0;
+    std::unique_ptr<char[]> data;
+};
+
+// Сообщение об ошибке записи TOML-кода (код из OutputBuffer::error)
+inline std::string outputErrorMessage(int error) {
+    return std::string("Ошибка записи TOML-кода: ") + strerror(error);
+}
+
+// Имя ключа TOML. Голые ключи состоят только из ASCII, поэтому имя
+// с символами вне ASCII пишется в кавычках; кавычек и обратной косой
+// черты в идентификаторах не бывает.
+inline void writeKeyName(OutputBuffer& out, std::string_view name) {
+    bool ascii = true;
+    for (char c : name) {
+        if ((unsigned char)c >= 0x80) {
+            ascii = false;
+            break;
+        }
+    }
+    if (!ascii) out.put('"');
+    out.write(name);
+    if (!ascii) out.put('"');
+}
+
+// Полный путь ключа через точку; сегменты пишутся как writeKeyName
+inline void writeKeyPath(OutputBuffer& out, std::string_view path) {
+    while (true) {
+        size_t dot = path.find('.');
+        writeKeyName(out, path.substr(0, dot));
+        if (dot == std::string_view::npos) return;
+        out.put('.');
+        path.remove_prefix(dot + 1);
+    }
+}
+
+// Открытие (создание или перезапись) файла для вывода; -1 при ошибке
+inline int openOutputFile(const char* path) {
+#ifdef _WIN32
+    return _open(path, _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    return open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+}
+
+// Закрытие файла вывода; false, если отложенная запись не удалась
+inline bool closeOutputFile(int fd) {
+#ifdef _WIN32
+    return _close(fd) == 0;
+#else
+    return close(fd) == 0;
+#endif
+}
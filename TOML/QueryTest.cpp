@@ -0,0 +1,128 @@
+// Тест запроса значений: Converter::query должен находить те же значения,
+// что выводит преобразование того же текста, и отклонять текст с теми же
+// ошибками, в том числе для ссылок на ключи того же словаря. Типы и
+// двоичные значения скаляров проверяются отдельно.
+// Сборка: cmake (цель query-test, запуск через ctest) или
+// g++ -O2 -std=c++17 QueryTest.cpp Converter.cpp Compiled.cpp Simd.cpp Unicode.cpp -lpthread -o query-test
+
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "Converter.h"
+
+using namespace std;
+
+struct QueryCase {
+    const char* text;
+    vector<string> paths;
+};
+
+static const QueryCase cases[] = {
+    // Ссылка на предыдущий ключ того же словаря
+    { "{ a: 1; b: $[a]; }\n", { "a", "b" } },
+    // Ключ словаря повторно объявляет константу: ошибка и при запросе
+    { "set a = 5;\n{ a: 1; b: $[a]; }\n", { "b" } },
+    // Ссылка на ключ, объявленный ниже в том же словаре
+    { "{ b: $[a]; a: 1; }\n", { "a" } },
+    // Вложенные словари видят ключи верхнего уровня, объявленные до них
+    { "set c = 2;\n{ a: $[c]; b: { x: $[a]; y: { z: $[c]; }; }; }\n{ e: $[a]; }\n",
+      { "a", "b", "b.x", "b.y.z", "e", "c" } },
+    // Словарь-константа, ссылки на неё и путь внутрь её значения
+    { "set d = { x: 1; y: { z: \"s\"; }; };\n{ k: $[d]; m: 3; }\nv = $[d];\n",
+      { "d", "d.y.z", "k", "k.x", "v.y", "m" } },
+    // Константа ссылается на себя; ключ-словарь не объявляет своё имя
+    { "set r = $[r];\nv = $[r];\n{ s: { x: 1; }; }\n{ t: $[r]; }\n", { "r", "v", "s.x", "t" } },
+    // Ссылка на имя, объявленное только ключом-словарём
+    { "{ s: { x: 1; }; }\n{ t: $[s]; }\n", { "t" } },
+    // Присваивание переменной и изменение константы
+    { "set c = 7;\nx = $[c];\n", { "x" } },
+    { "set c = 7;\nc = $[c];\n", { "c" } },
+    // Повторное объявление в операторе, от которого зависит значение
+    { "set a = 1;\n{ b: $[a]; }\n{ a: 2; }\n", { "b" } },
+};
+
+// Пути и значения из TOML-кода преобразования. Ключи пишутся полными
+// путями "путь = значение", таблица - заголовком "[путь]".
+struct Expected {
+    bool table = false;
+    string value;
+};
+
+static map<string, Expected> parseToml(const string& toml) {
+    map<string, Expected> result;
+    size_t at = 0;
+    while (at < toml.size()) {
+        size_t end = toml.find('\n', at);
+        if (end == string::npos) end = toml.size();
+        string line = toml.substr(at, end - at);
+        at = end + 1;
+        if (line.empty() || line[0] == '#') continue;
+        if (line[0] == '[') {
+            result[line.substr(1, line.size() - 2)].table = true;
+            continue;
+        }
+        size_t equals = line.find(" = ");
+        result[line.substr(0, equals)] = { false, line.substr(equals + 3) };
+    }
+    return result;
+}
+
+// Типы и значения скаляров, включая округлённое к нулю и nan со знаком
+static int checkTypes() {
+    QueryResult result = Converter().query(
+        "{ i: -12; f: 1e-400; g: -1e-400; n: -nan; x: 0x10; b: true; s: \"v\"; t: { k: 1; }; }\n",
+        { "i", "f", "g", "n", "x", "b", "s", "t" });
+    if (!result.success) {
+        printf("типы: %s\n", result.diagnostic.c_str());
+        return 1;
+    }
+    const vector<QueryValue>& v = result.values;
+    bool same = v[0].type == QUERY_INTEGER && v[0].integer == -12 &&
+        v[1].type == QUERY_FLOAT && v[1].number == 0 && !signbit(v[1].number) &&
+        v[2].type == QUERY_FLOAT && v[2].number == 0 && signbit(v[2].number) &&
+        v[3].type == QUERY_FLOAT && isnan(v[3].number) && signbit(v[3].number) && v[3].toml == "-nan" &&
+        v[4].type == QUERY_INTEGER && v[4].integer == 16 &&
+        v[5].type == QUERY_BOOLEAN && v[5].integer == 1 &&
+        v[6].type == QUERY_STRING && v[6].toml == "\"v\"" &&
+        v[7].type == QUERY_TABLE;
+    if (!same) printf("типы: значения не совпадают с ожидаемыми\n");
+    return same ? 0 : 1;
+}
+
+int main() {
+    int failures = checkTypes();
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        const QueryCase& test = cases[i];
+        ConversionResult converted = Converter().convert(string_view(test.text));
+        QueryResult queried = Converter().query(test.text, test.paths);
+
+        if (!converted.success || !queried.success) {
+            if (converted.success != queried.success || converted.diagnostic != queried.diagnostic) {
+                printf("вход %zu: преобразование: %s; запрос: %s\n", i,
+                    converted.success ? "успешно" : converted.diagnostic.c_str(),
+                    queried.success ? "успешно" : queried.diagnostic.c_str());
+                failures++;
+            }
+            continue;
+        }
+
+        map<string, Expected> expected = parseToml(converted.toml);
+        for (size_t k = 0; k < test.paths.size(); k++) {
+            const QueryValue& value = queried.values[k];
+            auto it = expected.find(test.paths[k]);
+            bool same = it == expected.end() ? !value.found :
+                value.found && (value.type == QUERY_TABLE) == it->second.table &&
+                (it->second.table || value.toml == it->second.value);
+            if (!same) {
+                printf("вход %zu, путь %s: запрос '%s', преобразование '%s'\n", i, test.paths[k].c_str(),
+                    value.found ? value.toml.c_str() : "(нет)",
+                    it == expected.end() ? "(нет)" : it->second.value.c_str());
+                failures++;
+            }
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
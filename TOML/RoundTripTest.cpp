@@ -0,0 +1,82 @@
+// Тест скомпилированного документа: TOML-код загруженного образа
+// (CompiledConfig::writeToml) должен побайтно совпадать с выводом
+// преобразования того же текста, в том числе для ключей вне ASCII.
+// Сборка: cmake (цель roundtrip-test, запуск через ctest) или
+// g++ -O2 -std=c++17 RoundTripTest.cpp Converter.cpp Compiled.cpp Simd.cpp Unicode.cpp -lpthread -o roundtrip-test
+
+#include <cstdio>
+#include <string>
+
+#include "Compiled.h"
+#include "Converter.h"
+
+using namespace std;
+
+static const char* const inputs[] = {
+    // Константы, переменные, словари и комментарии в ASCII
+    "%{ header\n comment %}\n"
+    "set port = 8080;\n"
+    "set name = \"server\";\n"
+    "set limits = { cpu: 2; memory: 512; };\n"
+    "-- line comment\n"
+    "p = $[port];\n"
+    "l = $[limits];\n"
+    "{ service: { host: $[name]; opts: { debug: false; retries: 3; }; }; }\n",
+
+    // Имена вне ASCII пишутся в кавычках
+    "set ключ = 1;\n"
+    "{ сервер: { порт: 80; адрес: \"узел\"; }; }\n"
+    "v = $[ключ];\n",
+
+    // Смесь имён ASCII и вне ASCII в одном пути, константа-словарь
+    "set Ω = { ζ: 1.5; inner_ключ: { x: true; }; };\n"
+    "копия = $[Ω];\n"
+    "{ app: { имя: \"α\"; v2: { ü: 0x10; w: -1_000; }; }; }\n",
+};
+
+// TOML-код загруженного образа через временный файл
+static bool loadedToml(const string& image, string& toml, string& error) {
+    CompiledConfig config;
+    if (!config.load(image, error)) return false;
+    FILE* file = tmpfile();
+    if (!file) {
+        error = "не удалось создать временный файл";
+        return false;
+    }
+    if (!config.writeToml(fileno(file), error)) {
+        fclose(file);
+        return false;
+    }
+    rewind(file);
+    char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) toml.append(buffer, read);
+    fclose(file);
+    return true;
+}
+
+int main() {
+    int failures = 0;
+    for (size_t i = 0; i < sizeof(inputs) / sizeof(inputs[0]); i++) {
+        string text = inputs[i];
+        ConversionResult converted = Converter().convert(string_view(text));
+
+        CompiledWriter writer;
+        ConversionResult compiled = Converter().compile(text, writer);
+        string image;
+        writer.serialize(image);
+
+        string loaded, error;
+        if (!converted.success || !compiled.success || !loadedToml(image, loaded, error)) {
+            printf("вход %zu: ошибка: %s%s%s\n", i, converted.diagnostic.c_str(),
+                compiled.diagnostic.c_str(), error.c_str());
+            failures++;
+        }
+        else if (loaded != converted.toml) {
+            printf("вход %zu: вывод образа отличается\n--- преобразование:\n%s--- образ:\n%s",
+                i, converted.toml.c_str(), loaded.c_str());
+            failures++;
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
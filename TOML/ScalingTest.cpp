@@ -0,0 +1,78 @@
+// Тест масштабирования разбора словарей.
+// Преобразует словари из 1 тыс., 10 тыс., 100 тыс. и 1 млн ключей и
+// проверяет, что время на ключ растёт не больше чем в MAX_RATIO раз от
+// самого быстрого размера. Таблицы имён и путей с миллионом записей не
+// помещаются в кэш, и время на ключ растёт в 4-7 раз; квадратичный
+// разбор списка ключей даёт рост в сотни раз. Малые словари преобразуются
+// повторно, чтобы каждое измерение обрабатывало не меньше KEYS_PER_RUN ключей.
+// Сборка: cmake (цель scaling-test, запуск через ctest) или
+// g++ -O2 -std=c++17 ScalingTest.cpp Converter.cpp Compiled.cpp Simd.cpp Unicode.cpp -lpthread -o scaling-test
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include "Converter.h"
+
+using namespace std;
+
+const double MAX_RATIO = 16;        // Допустимый рост времени на ключ
+const size_t KEYS_PER_RUN = 200000;
+const int RUNS = 2;
+
+// Словарь верхнего уровня { d: { k0: 0; k1: 1; ... }; }
+static string dictionary(size_t keys) {
+    string text = "{ d: {";
+    for (size_t k = 0; k < keys; k++) {
+        text += " k" + to_string(k) + ": " + to_string(k) + ";";
+    }
+    text += " }; }\n";
+    return text;
+}
+
+// Лучшее время преобразования на ключ в наносекундах; 0 - ошибка
+static double timePerKey(size_t keys) {
+    string text = dictionary(keys);
+    size_t repeats = max<size_t>(KEYS_PER_RUN / keys, 1);
+    Converter converter;
+    double best = 1e30;
+    for (int run = 0; run < RUNS; run++) {
+        auto start = chrono::steady_clock::now();
+        for (size_t r = 0; r < repeats; r++) {
+            ConversionResult result = converter.convert(string_view(text));
+            // Заголовок таблицы и строка на каждый ключ
+            size_t lines = count(result.toml.begin(), result.toml.end(), '\n');
+            if (!result.success || lines < keys + 1) {
+                printf("%zu ключей: ошибка преобразования: %s\n", keys, result.diagnostic.c_str());
+                return 0;
+            }
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        best = min(best, seconds);
+    }
+    return best * 1e9 / (keys * repeats);
+}
+
+int main() {
+    const size_t sizes[] = { 1000, 10000, 100000, 1000000 };
+    double times[4];
+    double fastest = 1e30;
+    for (int i = 0; i < 4; i++) {
+        times[i] = timePerKey(sizes[i]);
+        if (times[i] == 0) return 1;
+        fastest = min(fastest, times[i]);
+    }
+
+    bool passed = true;
+    for (int i = 0; i < 4; i++) {
+        double ratio = times[i] / fastest;
+        printf("%8zu ключей: %8.1f нс/ключ (x%.2f)\n", sizes[i], times[i], ratio);
+        if (ratio > MAX_RATIO) passed = false;
+    }
+    if (!passed) {
+        printf("Время на ключ выросло больше чем в %.0f раз\n", MAX_RATIO);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,392 @@
+#include "Simd.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "Unicode.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SIMD_TARGET_AVX2
+#else
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// Номер младшего установленного бита маски
+static inline int lowestBit(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// Скалярные реализации
+static const char* findByteScalar(const char* begin, const char* end, char c) {
+    const void* hit = memchr(begin, c, end - begin);
+    return hit ? (const char*)hit : end;
+}
+
+static const char* findPairScalar(const char* begin, const char* end, char a, char b) {
+    for (const char* p = begin; p + 1 < end; p++) {
+        if (p[0] == a && p[1] == b) return p;
+    }
+    return end;
+}
+
+// ASCII проверяется по 8 байт, остальное - по последовательностям
+static const char* validateUtf8Scalar(const char* begin, const char* end) {
+    const char* p = begin;
+    while (p < end) {
+        if (end - p >= 8) {
+            uint64_t word;
+            memcpy(&word, p, 8);
+            if ((word & 0x8080808080808080ULL) == 0) {
+                p += 8;
+                continue;
+            }
+        }
+        if ((unsigned char)*p < 0x80) {
+            p++;
+            continue;
+        }
+        char32_t cp;
+        size_t length = decodeUtf8(p, end, cp);
+        if (length == 0) return p;
+        p += length;
+    }
+    return end;
+}
+
+// Позиция, с которой проверка продолжается скалярно, если [begin, p)
+// проверено: начальный байт среди трёх байтов перед p, за которым идут
+// только продолжения, - последовательность могла остаться незаконченной
+static const char* restartPoint(const char* begin, const char* p) {
+    for (ptrdiff_t back = 1; back <= 3 && back <= p - begin; back++) {
+        unsigned char c = (unsigned char)p[-back];
+        if (c >= 0xC0) return p - back;
+        if (c < 0x80) break;
+    }
+    return p;
+}
+
+#ifdef SIMD_X86
+// SSE2: сравнение 16 байт за инструкцию, по четыре блока за итерацию
+static const char* findByteSse2(const char* begin, const char* end, char c) {
+    const __m128i needle = _mm_set1_epi8(c);
+    const char* p = begin;
+    for (; p + 64 <= end; p += 64) {
+        __m128i eq0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), needle);
+        __m128i eq1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), needle);
+        __m128i eq2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 32)), needle);
+        __m128i eq3 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 48)), needle);
+        __m128i any = _mm_or_si128(_mm_or_si128(eq0, eq1), _mm_or_si128(eq2, eq3));
+        if (_mm_movemask_epi8(any)) break;
+    }
+    for (; p + 16 <= end; p += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i*)p);
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block, needle));
+        if (mask) return p + lowestBit(mask);
+    }
+    for (; p < end; p++) {
+        if (*p == c) return p;
+    }
+    return end;
+}
+
+static const char* findPairSse2(const char* begin, const char* end, char a, char b) {
+    const __m128i first = _mm_set1_epi8(a);
+    const __m128i second = _mm_set1_epi8(b);
+    const char* p = begin;
+    // Второй байт пары берётся из блока, сдвинутого на одну позицию
+    for (; p + 33 <= end; p += 32) {
+        __m128i eq0 = _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), first),
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 1)), second));
+        __m128i eq1 = _mm_and_si128(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 16)), first),
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(p + 17)), second));
+        if (_mm_movemask_epi8(_mm_or_si128(eq0, eq1))) break;
+    }
+    for (; p + 17 <= end; p += 16) {
+        __m128i block0 = _mm_loadu_si128((const __m128i*)p);
+        __m128i block1 = _mm_loadu_si128((const __m128i*)(p + 1));
+        __m128i eq = _mm_and_si128(_mm_cmpeq_epi8(block0, first), _mm_cmpeq_epi8(block1, second));
+        unsigned mask = (unsigned)_mm_movemask_epi8(eq);
+        if (mask) return p + lowestBit(mask);
+    }
+    return findPairScalar(p, end, a, b);
+}
+
+// AVX2: сравнение 32 байт за инструкцию, по четыре блока за итерацию
+SIMD_TARGET_AVX2
+static const char* findByteAvx2(const char* begin, const char* end, char c) {
+    const __m256i needle = _mm256_set1_epi8(c);
+    const char* p = begin;
+    for (; p + 128 <= end; p += 128) {
+        __m256i eq0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), needle);
+        __m256i eq1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 32)), needle);
+        __m256i eq2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 64)), needle);
+        __m256i eq3 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 96)), needle);
+        __m256i any = _mm256_or_si256(_mm256_or_si256(eq0, eq1), _mm256_or_si256(eq2, eq3));
+        if (_mm256_movemask_epi8(any)) break;
+    }
+    for (; p + 32 <= end; p += 32) {
+        __m256i block = _mm256_loadu_si256((const __m256i*)p);
+        unsigned mask = (unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, needle));
+        if (mask) return p + lowestBit(mask);
+    }
+    return findByteSse2(p, end, c);
+}
+
+SIMD_TARGET_AVX2
+static const char* findPairAvx2(const char* begin, const char* end, char a, char b) {
+    const __m256i first = _mm256_set1_epi8(a);
+    const __m256i second = _mm256_set1_epi8(b);
+    const char* p = begin;
+    for (; p + 65 <= end; p += 64) {
+        __m256i eq0 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), first),
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 1)), second));
+        __m256i eq1 = _mm256_and_si256(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 32)), first),
+            _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(p + 33)), second));
+        if (_mm256_movemask_epi8(_mm256_or_si256(eq0, eq1))) break;
+    }
+    for (; p + 33 <= end; p += 32) {
+        __m256i block0 = _mm256_loadu_si256((const __m256i*)p);
+        __m256i block1 = _mm256_loadu_si256((const __m256i*)(p + 1));
+        __m256i eq = _mm256_and_si256(_mm256_cmpeq_epi8(block0, first), _mm256_cmpeq_epi8(block1, second));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(eq);
+        if (mask) return p + lowestBit(mask);
+    }
+    return findPairSse2(p, end, a, b);
+}
+
+// Проверка UTF-8 (SSE2): блоки по 16 байт без старшего бита пропускаются
+// целиком, остальные проверяются по последовательностям
+static const char* validateUtf8Sse2(const char* begin, const char* end) {
+    const char* p = begin;
+    while (p + 16 <= end) {
+        if (_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)p)) == 0) {
+            p += 16;
+            continue;
+        }
+        const char* blockEnd = p + 16;
+        while (p < blockEnd) {
+            if ((unsigned char)*p < 0x80) {
+                p++;
+                continue;
+            }
+            char32_t cp;
+            size_t length = decodeUtf8(p, end, cp);
+            if (length == 0) return p;
+            p += length;
+        }
+    }
+    return validateUtf8Scalar(p, end);
+}
+
+// Проверка UTF-8 (AVX2) по таблицам старших и младших полубайтов
+// (Keiser, Lemire. Validating UTF-8 in less than one instruction per byte).
+// Ошибки пары соседних байтов ищутся тремя выборками по 16-элементным
+// таблицам, обязательные второй и третий байты продолжения - по байтам
+// на два и три назад. Блок с ошибкой проверяется заново скалярно, чтобы
+// найти её точное место.
+enum : uint8_t {
+    UTF8_TOO_SHORT = 1 << 0,    // Начальный байт без продолжения
+    UTF8_TOO_LONG = 1 << 1,     // Продолжение после ASCII
+    UTF8_OVERLONG_3 = 1 << 2,   // E0 80..9F
+    UTF8_TOO_LARGE = 1 << 3,    // F4 90..BF и F5..FF
+    UTF8_SURROGATE = 1 << 4,    // ED A0..BF
+    UTF8_OVERLONG_2 = 1 << 5,   // C0, C1
+    UTF8_TOO_LARGE_1000 = 1 << 6,   // F5..FF 80..8F
+    UTF8_OVERLONG_4 = 1 << 6,   // F0 80..8F
+    UTF8_TWO_CONTS = 1 << 7,    // Продолжение после продолжения
+    UTF8_CARRY = UTF8_TOO_SHORT | UTF8_TOO_LONG | UTF8_TWO_CONTS
+};
+
+SIMD_TARGET_AVX2
+static inline __m256i utf8BlockErrorsAvx2(__m256i input, __m256i previous) {
+    const __m256i byte1HighTable = _mm256_setr_epi8(
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        (char)(UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4),
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG, UTF8_TOO_LONG,
+        UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS, UTF8_TWO_CONTS,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_2,
+        UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT | UTF8_OVERLONG_3 | UTF8_SURROGATE,
+        (char)(UTF8_TOO_SHORT | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4));
+    const char large = (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000);
+    const __m256i byte1LowTable = _mm256_setr_epi8(
+        (char)(UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4),
+        UTF8_CARRY | UTF8_OVERLONG_2,
+        UTF8_CARRY, UTF8_CARRY,
+        UTF8_CARRY | UTF8_TOO_LARGE,
+        large, large, large, large, large, large, large, large,
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE),
+        large, large,
+        (char)(UTF8_CARRY | UTF8_OVERLONG_3 | UTF8_OVERLONG_2 | UTF8_OVERLONG_4),
+        UTF8_CARRY | UTF8_OVERLONG_2,
+        UTF8_CARRY, UTF8_CARRY,
+        UTF8_CARRY | UTF8_TOO_LARGE,
+        large, large, large, large, large, large, large, large,
+        (char)(UTF8_CARRY | UTF8_TOO_LARGE | UTF8_TOO_LARGE_1000 | UTF8_SURROGATE),
+        large, large);
+    const char conts1000 = (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE_1000 | UTF8_OVERLONG_4);
+    const char conts1001 = (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_OVERLONG_3 | UTF8_TOO_LARGE);
+    const char conts101 = (char)(UTF8_TOO_LONG | UTF8_OVERLONG_2 | UTF8_TWO_CONTS | UTF8_SURROGATE | UTF8_TOO_LARGE);
+    const __m256i byte2HighTable = _mm256_setr_epi8(
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        conts1000, conts1001, conts101, conts101,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT,
+        conts1000, conts1001, conts101, conts101,
+        UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT, UTF8_TOO_SHORT);
+    const __m256i lowNibble = _mm256_set1_epi8(0x0F);
+
+    // Байты на одну, две и три позиции назад с учётом предыдущего блока
+    __m256i shifted = _mm256_permute2x128_si256(previous, input, 0x21);
+    __m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+    __m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+    __m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+
+    __m256i byte1High = _mm256_shuffle_epi8(byte1HighTable, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), lowNibble));
+    __m256i byte1Low = _mm256_shuffle_epi8(byte1LowTable, _mm256_and_si256(prev1, lowNibble));
+    __m256i byte2High = _mm256_shuffle_epi8(byte2HighTable, _mm256_and_si256(_mm256_srli_epi16(input, 4), lowNibble));
+    __m256i special = _mm256_and_si256(_mm256_and_si256(byte1High, byte1Low), byte2High);
+
+    // Третий байт после 111xxxxx и четвёртый после 11110xxx обязаны быть
+    // продолжениями; для них в special остаётся только бит TWO_CONTS
+    __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+    __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+    __m256i required = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(required, special);
+}
+
+SIMD_TARGET_AVX2
+static const char* validateUtf8Avx2(const char* begin, const char* end) {
+    // Последние байты блока, с которых может начинаться незаконченная
+    // последовательность: ...F0, E0, C0 и больше
+    const __m256i incompleteBound = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+    __m256i previous = _mm256_setzero_si256();
+    __m256i incomplete = _mm256_setzero_si256();
+    const char* p = begin;
+    for (; p + 32 <= end; p += 32) {
+        __m256i input = _mm256_loadu_si256((const __m256i*)p);
+        __m256i errors;
+        if (_mm256_movemask_epi8(input) == 0) {
+            // Блок ASCII: ошибка, только если предыдущий не закончен
+            errors = incomplete;
+            incomplete = _mm256_setzero_si256();
+        }
+        else {
+            errors = utf8BlockErrorsAvx2(input, previous);
+            incomplete = _mm256_subs_epu8(input, incompleteBound);
+        }
+        if (!_mm256_testz_si256(errors, errors)) break;
+        previous = input;
+    }
+    // Остаток и блок с ошибкой проверяются с начала последнего символа
+    return validateUtf8Scalar(restartPoint(begin, p), end);
+}
+#endif
+
+SimdLevel detectSimdLevel() {
+#ifdef SIMD_X86
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] >= 7) {
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1 << 27)) != 0;
+        bool avx = (info[2] & (1 << 28)) != 0;
+        // Регистры YMM должны сохраняться операционной системой
+        if (osxsave && avx && (_xgetbv(0) & 6) == 6) {
+            __cpuidex(info, 7, 0);
+            if (info[1] & (1 << 5)) return SIMD_AVX2;
+        }
+    }
+    return SIMD_SSE2;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return SIMD_AVX2;
+    if (__builtin_cpu_supports("sse2")) return SIMD_SSE2;
+    return SIMD_SCALAR;
+#endif
+#else
+    return SIMD_SCALAR;
+#endif
+}
+
+// Таблица диспетчеризации
+static SimdLevel currentLevel = SIMD_SCALAR;
+static const char* (*findByteImpl)(const char*, const char*, char) = findByteScalar;
+static const char* (*findPairImpl)(const char*, const char*, char, char) = findPairScalar;
+static const char* (*validateUtf8Impl)(const char*, const char*) = validateUtf8Scalar;
+
+void setSimdLevel(SimdLevel level) {
+    SimdLevel supported = detectSimdLevel();
+    if (level > supported) level = supported;
+    currentLevel = level;
+    switch (level) {
+#ifdef SIMD_X86
+    case SIMD_AVX2:
+        findByteImpl = findByteAvx2;
+        findPairImpl = findPairAvx2;
+        validateUtf8Impl = validateUtf8Avx2;
+        break;
+    case SIMD_SSE2:
+        findByteImpl = findByteSse2;
+        findPairImpl = findPairSse2;
+        validateUtf8Impl = validateUtf8Sse2;
+        break;
+#endif
+    default:
+        findByteImpl = findByteScalar;
+        findPairImpl = findPairScalar;
+        validateUtf8Impl = validateUtf8Scalar;
+        break;
+    }
+}
+
+// Выбор реализации при запуске программы
+static const bool simdInitialized = (setSimdLevel(detectSimdLevel()), true);
+
+SimdLevel simdLevel() {
+    return currentLevel;
+}
+
+const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+    case SIMD_AVX2: return "avx2";
+    case SIMD_SSE2: return "sse2";
+    default: return "scalar";
+    }
+}
+
+const char* findByte(const char* begin, const char* end, char c) {
+    return findByteImpl(begin, end, c);
+}
+
+const char* findPair(const char* begin, const char* end, char a, char b) {
+    return findPairImpl(begin, end, a, b);
+}
+
+const char* validateUtf8(const char* begin, const char* end) {
+    return validateUtf8Impl(begin, end);
+}
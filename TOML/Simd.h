@@ -0,0 +1,32 @@
+#pragma once
+
+// ВЕКТОРНЫЕ ЯДРА ПОИСКА ДЛЯ СКАНЕРА
+// Поиск ограничителя и проверка UTF-8 блоками по 16 (SSE2) или 32 (AVX2) байта.
+// Реализация выбирается один раз при запуске по возможностям процессора.
+
+// Уровень используемых векторных инструкций
+enum SimdLevel {
+    SIMD_SCALAR = 0,  // Скалярный поиск
+    SIMD_SSE2 = 1,    // Блоки по 16 байт
+    SIMD_AVX2 = 2     // Блоки по 32 байта
+};
+
+// Поиск первого байта c в [begin, end). Возвращает end, если байт не найден.
+const char* findByte(const char* begin, const char* end, char c);
+
+// Поиск первой пары соседних байтов "ab" в [begin, end).
+// Возвращает указатель на a или end, если пара не найдена.
+const char* findPair(const char* begin, const char* end, char a, char b);
+
+// Проверка UTF-8 в [begin, end). Возвращает указатель на первый байт
+// неверной или незаконченной последовательности или end.
+const char* validateUtf8(const char* begin, const char* end);
+
+// Лучший уровень, поддерживаемый процессором
+SimdLevel detectSimdLevel();
+
+// Текущий уровень и его принудительная смена (не выше поддерживаемого)
+SimdLevel simdLevel();
+void setSimdLevel(SimdLevel level);
+
+const char* simdLevelName(SimdLevel level);
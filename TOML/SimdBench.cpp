@@ -0,0 +1,74 @@
+// Микробенчмарк векторных ядер поиска сканера.
+// Сравнивает скорость поиска конца комментария, строки и строки-комментария
+// и проверки UTF-8 (латиница и кириллица) на всех уровнях, доступных процессору.
+// Сборка: g++ -O2 -std=c++17 SimdBench.cpp Simd.cpp Unicode.cpp -o simdbench
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "Simd.h"
+
+using namespace std;
+
+// Время одного прохода по буферу в наносекундах (лучшее из нескольких).
+// Поиск должен остановиться за tail байт до конца буфера.
+template <class Search>
+static double measure(const string& buffer, Search search, size_t tail = 2) {
+    double best = 1e30;
+    for (int run = 0; run < 20; run++) {
+        auto start = chrono::steady_clock::now();
+        const char* hit = search(buffer.data(), buffer.data() + buffer.size());
+        auto finish = chrono::steady_clock::now();
+        if (hit != buffer.data() + buffer.size() - tail) printf("ошибка поиска\n");
+        double ns = chrono::duration<double, nano>(finish - start).count();
+        if (ns < best) best = ns;
+    }
+    return best;
+}
+
+int main() {
+    // Тело большого комментария без ограничителей, терминатор в самом конце
+    const size_t size = 16 * 1024 * 1024;
+    string body;
+    body.reserve(size);
+    const char* text = "Licensed under the terms of the license; see 100% of LICENSE for details. ";
+    while (body.size() < size - 2) body += text[body.size() % 74];
+    body.resize(size - 2);
+
+    string comment = body + "%}";
+    string line = body + "\n ";
+    string literal = body + "\" ";
+
+    // Текст комментария на кириллице: два байта на букву
+    string cyrillic;
+    cyrillic.reserve(size);
+    const char* word = "Лицензия распространяется на 100% файлов; см. LICENSE. ";
+    for (size_t i = 0; cyrillic.size() < size; i++) {
+        cyrillic += word[i % strlen(word)];
+    }
+    while ((unsigned char)cyrillic.back() >= 0x80) cyrillic.pop_back();
+
+    SimdLevel supported = detectSimdLevel();
+    printf("%-8s %12s %12s %12s %12s %12s\n", "level", "%} GB/s", "\\n GB/s", "\" GB/s", "utf8 GB/s", "utf8-ru GB/s");
+    for (int level = SIMD_SCALAR; level <= supported; level++) {
+        setSimdLevel((SimdLevel)level);
+        double pair = measure(comment, [](const char* b, const char* e) { return findPair(b, e, '%', '}'); });
+        double newline = measure(line, [](const char* b, const char* e) { return findByte(b, e, '\n'); });
+        double quote = measure(literal, [](const char* b, const char* e) { return findByte(b, e, '"'); });
+        double ascii = measure(body, validateUtf8, 0);
+        double text = measure(cyrillic, validateUtf8, 0);
+        printf("%-8s %12.2f %12.2f %12.2f %12.2f %12.2f\n", simdLevelName((SimdLevel)level),
+            size / pair, size / newline, size / quote, body.size() / ascii, cyrillic.size() / text);
+    }
+
+    // Исходный побайтовый цикл состояния C2 для сравнения
+    double bytewise = measure(comment, [](const char* b, const char* e) {
+        const char* p = b;
+        while (p + 1 < e && !(p[0] == '%' && p[1] == '}')) p++;
+        return p;
+    });
+    printf("%-8s %12.2f\n", "bytewise", size / bytewise);
+    return 0;
+}
@@ -0,0 +1,183 @@
+#include "Snapshot.h"
+
+#include <algorithm>
+#include <functional>
+
+using namespace std;
+
+// ПОСТРОЕНИЕ СНИМКА
+unique_ptr<const ConfigSnapshot> ConfigSnapshot::build(string_view text, const ConverterOptions& options, string& error) {
+    // Печать токенов и AST при построении снимка не выполняется
+    ConverterOptions compileOptions = options;
+    compileOptions.tokenDump = nullptr;
+    compileOptions.astDump = nullptr;
+    Converter converter(compileOptions);
+    CompiledWriter writer;
+    ConversionResult result = converter.compile(text, writer);
+    if (!result.success) {
+        error = result.diagnostic;
+        return nullptr;
+    }
+    string image;
+    writer.serialize(image);
+
+    unique_ptr<ConfigSnapshot> snapshot(new ConfigSnapshot());
+    if (!snapshot->image.load(move(image), error)) return nullptr;
+
+    // Не больше половины ячеек занято; запись с тем же путём
+    // заменяет прежнюю, поэтому остаётся последнее значение
+    const CompiledConfig& document = snapshot->image;
+    size_t capacity = 16;
+    while (capacity < document.size() * 2) capacity *= 2;
+    vector<uint32_t>& slots = snapshot->slots;
+    slots.assign(capacity, 0);
+    size_t mask = capacity - 1;
+    for (size_t i = 0; i < document.size(); i++) {
+        CompiledEntry record = document.entry(i);
+        if (record.kind == COMPILED_COMMENT) continue;
+        size_t slot = hash<string_view>()(record.path) & mask;
+        while (slots[slot] != 0 && document.entry(slots[slot] - 1).path != record.path) {
+            slot = (slot + 1) & mask;
+        }
+        if (slots[slot] == 0) snapshot->count++;
+        slots[slot] = (uint32_t)i + 1;
+    }
+    return snapshot;
+}
+
+bool ConfigSnapshot::find(string_view path, CompiledEntry& entry) const {
+    size_t mask = slots.size() - 1;
+    for (size_t slot = hash<string_view>()(path) & mask; slots[slot] != 0; slot = (slot + 1) & mask) {
+        CompiledEntry candidate = image.entry(slots[slot] - 1);
+        if (candidate.path == path) {
+            entry = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+// ЭПОХИ ЧТЕНИЯ
+// Общие для всех объектов SharedConfig. Каждый читающий поток имеет ячейку
+// с эпохой начала внешнего чтения (0 - поток не читает). Замена снимка
+// увеличивает эпоху; снимок, заменённый при переходе от эпохи e, может
+// читаться только потоками с эпохой не больше e.
+namespace {
+
+// Ячейка занимает собственную строку кэша, чтобы запись эпохи
+// одним потоком не мешала другим
+struct alignas(64) ReaderSlot {
+    atomic<uint64_t> epoch{ 0 };
+    unsigned depth = 0;     // Вложенность Reader; меняется только потоком-владельцем
+};
+
+struct EpochDomain {
+    atomic<uint64_t> epoch{ 1 };
+    mutex guard;                    // Список ячеек
+    vector<ReaderSlot*> slots;
+
+    // Наименьшая эпоха читающих потоков (UINT64_MAX - никто не читает)
+    uint64_t oldestReader() {
+        lock_guard<mutex> lock(guard);
+        uint64_t oldest = UINT64_MAX;
+        for (ReaderSlot* slot : slots) {
+            uint64_t epoch = slot->epoch.load(memory_order_seq_cst);
+            if (epoch != 0) oldest = min(oldest, epoch);
+        }
+        return oldest;
+    }
+};
+
+EpochDomain& epochDomain() {
+    static EpochDomain domain;
+    return domain;
+}
+
+// Ячейка регистрируется при первом чтении в потоке и снимается при его завершении
+struct ThreadSlot {
+    ReaderSlot* slot;
+
+    ThreadSlot() : slot(new ReaderSlot()) {
+        EpochDomain& domain = epochDomain();
+        lock_guard<mutex> lock(domain.guard);
+        domain.slots.push_back(slot);
+    }
+
+    ~ThreadSlot() {
+        EpochDomain& domain = epochDomain();
+        {
+            lock_guard<mutex> lock(domain.guard);
+            domain.slots.erase(find(domain.slots.begin(), domain.slots.end(), slot));
+        }
+        delete slot;
+    }
+};
+
+ReaderSlot& threadSlot() {
+    thread_local ThreadSlot slot;
+    return *slot.slot;
+}
+
+}
+
+// ОБЩАЯ КОНФИГУРАЦИЯ
+SharedConfig::Reader::Reader(const SharedConfig& config) {
+    ReaderSlot& slot = threadSlot();
+    if (slot.depth++ == 0) {
+        // Эпоха отмечается до загрузки указателя: замена, не увидевшая
+        // отметку, уже опубликовала новый снимок, и поток прочтёт его
+        slot.epoch.store(epochDomain().epoch.load(memory_order_seq_cst), memory_order_seq_cst);
+    }
+    snapshot = config.current.load(memory_order_seq_cst);
+}
+
+SharedConfig::Reader::~Reader() {
+    ReaderSlot& slot = threadSlot();
+    if (--slot.depth == 0) slot.epoch.store(0, memory_order_release);
+}
+
+SharedConfig::~SharedConfig() {
+    delete current.load(memory_order_relaxed);
+    for (const Retired& entry : retired) delete entry.snapshot;
+}
+
+void SharedConfig::publish(unique_ptr<const ConfigSnapshot> snapshot) {
+    lock_guard<mutex> lock(publishGuard);
+    const ConfigSnapshot* previous = current.exchange(snapshot.release(), memory_order_seq_cst);
+    uint64_t epoch = epochDomain().epoch.fetch_add(1, memory_order_seq_cst);
+    published.fetch_add(1, memory_order_release);
+    if (previous) retired.push_back({ previous, epoch });
+    reclaim();
+}
+
+// Освобождение снимков, которые больше никто не может читать
+void SharedConfig::reclaim() {
+    if (retired.empty()) return;
+    uint64_t oldest = epochDomain().oldestReader();
+    auto kept = remove_if(retired.begin(), retired.end(), [&](const Retired& entry) {
+        if (entry.epoch >= oldest) return false;
+        delete entry.snapshot;
+        return true;
+    });
+    retired.erase(kept, retired.end());
+}
+
+size_t SharedConfig::retiredCount() const {
+    lock_guard<mutex> lock(publishGuard);
+    return retired.size();
+}
+
+ConversionResult SharedConfig::reload(string_view text, const ConverterOptions& options) {
+    ConversionResult result;
+    unique_ptr<const ConfigSnapshot> snapshot = ConfigSnapshot::build(text, options, result.diagnostic);
+    if (!snapshot) return result;
+    publish(move(snapshot));
+    result.success = true;
+    return result;
+}
+
+future<ConversionResult> SharedConfig::reloadAsync(string text, const ConverterOptions& options) {
+    return async(launch::async, [this, options](string text) {
+        return reload(text, options);
+    }, move(text));
+}
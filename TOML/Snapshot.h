@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Compiled.h"
+#include "Converter.h"
+
+// СНИМОК КОНФИГУРАЦИИ
+// Неизменяемый результат преобразования для чтения из многих потоков:
+// скомпилированный документ (Compiled.h) в памяти и хеш-таблица путей
+// ключей и таблиц с открытой адресацией. Значения ключей типизированы
+// так же, как в скомпилированном документе.
+class ConfigSnapshot {
+public:
+    // Преобразование текста в снимок; при ошибке - nullptr и сообщение в error
+    static std::unique_ptr<const ConfigSnapshot> build(std::string_view text, const ConverterOptions& options, std::string& error);
+
+    ConfigSnapshot(const ConfigSnapshot&) = delete;
+    ConfigSnapshot& operator=(const ConfigSnapshot&) = delete;
+
+    // Поиск ключа или таблицы по полному пути через точку. Для ключа,
+    // которому значение присваивалось несколько раз, - последнее значение.
+    bool find(std::string_view path, CompiledEntry& entry) const;
+
+    // Число различных путей
+    size_t size() const { return count; }
+
+    // Записи документа в порядке вывода
+    const CompiledConfig& document() const { return image; }
+
+private:
+    ConfigSnapshot() = default;
+
+    CompiledConfig image;
+    std::vector<uint32_t> slots;    // Номер записи + 1 (0 - пустая ячейка), размер - степень двойки
+    size_t count = 0;
+};
+
+// ОБЩАЯ КОНФИГУРАЦИЯ С ЗАМЕНОЙ СНИМКА
+// Текущий снимок публикуется атомарным указателем. Чтение не берёт
+// блокировок: поток отмечает в своей ячейке эпоху, с которой он читает,
+// и загружает указатель. Замена не ждёт читателей: прежний снимок
+// откладывается и освобождается при следующих заменах, когда не остаётся
+// потоков, читающих с эпохи, в которую он был текущим. Блокировка берётся
+// только при первом чтении в потоке (регистрация ячейки) и при замене.
+class SharedConfig {
+public:
+    SharedConfig() = default;
+    // Объект разрушается, когда читателей и замен уже нет
+    ~SharedConfig();
+
+    SharedConfig(const SharedConfig&) = delete;
+    SharedConfig& operator=(const SharedConfig&) = delete;
+
+    // Чтение текущего снимка; снимок действителен, пока жив объект.
+    // Объекты Reader одного потока могут быть вложенными.
+    class Reader {
+    public:
+        explicit Reader(const SharedConfig& config);
+        ~Reader();
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        // nullptr, если снимок ещё не опубликован
+        const ConfigSnapshot* get() const { return snapshot; }
+        const ConfigSnapshot* operator->() const { return snapshot; }
+        explicit operator bool() const { return snapshot != nullptr; }
+
+    private:
+        const ConfigSnapshot* snapshot;
+    };
+
+    // Публикация нового снимка вместо текущего
+    void publish(std::unique_ptr<const ConfigSnapshot> snapshot);
+
+    // Преобразование текста и публикация снимка в вызывающем потоке.
+    // При ошибке текущий снимок не меняется.
+    ConversionResult reload(std::string_view text, const ConverterOptions& options);
+
+    // То же в отдельном потоке; текст копируется
+    std::future<ConversionResult> reloadAsync(std::string text, const ConverterOptions& options);
+
+    // Число опубликованных снимков
+    uint64_t version() const { return published.load(std::memory_order_acquire); }
+
+    // Снимки, заменённые, но ещё не освобождённые
+    size_t retiredCount() const;
+
+private:
+    void reclaim();
+
+    // Снимок, заменённый при переходе к эпохе epoch + 1
+    struct Retired {
+        const ConfigSnapshot* snapshot;
+        uint64_t epoch;
+    };
+
+    std::atomic<const ConfigSnapshot*> current{ nullptr };
+    std::atomic<uint64_t> published{ 0 };
+    mutable std::mutex publishGuard;     // Только между заменами
+    std::vector<Retired> retired;
+};
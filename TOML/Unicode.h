@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+
+// UNICODE
+// Вход преобразователя - текст в UTF-8. Идентификаторы вне ASCII
+// классифицируются по свойствам XID_Start и XID_Continue, как
+// в Unicode Standard Annex #31; ASCII проверяется таблицей сканера.
+
+// Последовательность UTF-8 в начале [begin, end): длина и код в cp.
+// 0 - последовательность неверна или не помещается в [begin, end).
+size_t decodeUtf8(const char* begin, const char* end, char32_t& cp);
+
+// Начало и продолжение идентификатора для кодов вне ASCII
+bool isXidStart(char32_t cp);
+bool isXidContinue(char32_t cp);
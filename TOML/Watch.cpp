@@ -0,0 +1,190 @@
+#include "Watch.h"
+
+#include <chrono>
+#include <ostream>
+
+#ifdef __linux__
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <filesystem>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef __linux__
+
+namespace fs = std::filesystem;
+
+// Чтение файла целиком в text; false при ошибке
+static bool readWholeFile(const string& path, string& text) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+    struct stat info;
+    if (fstat(fd, &info) < 0) {
+        close(fd);
+        return false;
+    }
+    // Размер может измениться во время чтения, поэтому читаем до конца файла
+    text.resize((size_t)info.st_size + 1);
+    size_t used = 0;
+    while (true) {
+        if (used == text.size()) text.resize(text.size() * 2);
+        ssize_t chunk = read(fd, &text[used], text.size() - used);
+        if (chunk < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return false;
+        }
+        if (chunk == 0) break;
+        used += (size_t)chunk;
+    }
+    close(fd);
+    text.resize(used);
+    return true;
+}
+
+// Запись size байт по смещению offset; false при ошибке
+static bool writeAt(int fd, const char* data, size_t size, size_t offset) {
+    while (size > 0) {
+        ssize_t chunk = pwrite(fd, data, size, (off_t)offset);
+        if (chunk < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        data += chunk;
+        size -= (size_t)chunk;
+        offset += (size_t)chunk;
+    }
+    return true;
+}
+
+// Ожидание сохранения файла name в каталоге, наблюдаемом через inotify.
+// События, пришедшие следом друг за другом, объединяются в одно.
+static bool waitForSave(int notify, const string& name) {
+    alignas(inotify_event) char events[64 * (sizeof(inotify_event) + NAME_MAX + 1)];
+    bool saved = false;
+    int timeout = -1;
+    while (true) {
+        pollfd request = { notify, POLLIN, 0 };
+        int ready = poll(&request, 1, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (ready == 0) return true;
+        ssize_t size = read(notify, events, sizeof(events));
+        if (size < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        for (char* p = events; p < events + size;) {
+            const inotify_event* event = (const inotify_event*)p;
+            if (event->len > 0 && name == event->name) saved = true;
+            p += sizeof(inotify_event) + event->len;
+        }
+        // Редакторы сохраняют файл несколькими операциями: ждём затишья
+        if (saved) timeout = 20;
+    }
+}
+
+static double elapsedMs(chrono::steady_clock::time_point start) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+int watchFile(const string& path, const WatchOptions& options, ostream& log) {
+    fs::path input(path);
+    string directory = input.has_parent_path() ? input.parent_path().string() : string(".");
+    string name = input.filename().string();
+    string outputPath = options.outputPath.empty() ? path + ".toml" : options.outputPath;
+
+    // Наблюдение за каталогом, а не за файлом: многие редакторы сохраняют
+    // новую версию во временный файл и переименовывают его
+    int notify = inotify_init1(IN_CLOEXEC);
+    if (notify < 0 || inotify_add_watch(notify, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        log << "Не удалось наблюдать за каталогом " << directory << ": " << strerror(errno) << endl;
+        if (notify >= 0) close(notify);
+        return 1;
+    }
+    int outputFd = open(outputPath.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (outputFd < 0) {
+        log << "Не удалось открыть файл " << outputPath << endl;
+        close(notify);
+        return 1;
+    }
+
+    ConverterOptions converterOptions = options.converter;
+    converterOptions.tokenDump = nullptr;
+    converterOptions.astDump = nullptr;
+    IncrementalConverter converter(converterOptions);
+    string text;
+    bool written = false;    // Файл результата содержит converter.toml()
+
+    log << "Наблюдение за " << path << ", результат в " << outputPath << endl;
+    do {
+        auto start = chrono::steady_clock::now();
+        if (!readWholeFile(path, text)) {
+            log << "Не удалось прочитать файл " << path << endl;
+            continue;
+        }
+        double readTime = elapsedMs(start);
+
+        start = chrono::steady_clock::now();
+        ConversionResult result = converter.update(text);
+        double convertTime = elapsedMs(start);
+        if (!result.success) {
+            log << result.diagnostic << endl;
+            log << "Файл результата не изменён" << endl;
+            continue;
+        }
+
+        // Переписывается только изменённая часть TOML-кода; при изменении
+        // длины сдвигается и всё, что за ней
+        start = chrono::steady_clock::now();
+        const string& toml = converter.toml();
+        const DocumentChange& change = converter.lastChange();
+        bool ok;
+        if (!written) {
+            ok = writeAt(outputFd, toml.data(), toml.size(), 0) && ftruncate(outputFd, (off_t)toml.size()) == 0;
+        }
+        else if (change.end - change.begin == change.oldEnd - change.begin) {
+            ok = writeAt(outputFd, toml.data() + change.begin, change.end - change.begin, change.begin);
+        }
+        else {
+            ok = writeAt(outputFd, toml.data() + change.begin, toml.size() - change.begin, change.begin)
+                && ftruncate(outputFd, (off_t)toml.size()) == 0;
+        }
+        written = ok;
+        if (!ok) {
+            log << "Не удалось записать файл " << outputPath << ": " << strerror(errno) << endl;
+            continue;
+        }
+        double writeTime = elapsedMs(start);
+
+        log << "Обновлено: чтение " << readTime << " мс, преобразование " << convertTime
+            << " мс, запись " << writeTime << " мс; операторов разобрано " << change.parsed
+            << ", сгенерировано " << change.analyzed << ", повторно проанализировано " << change.replayed << endl;
+    } while (waitForSave(notify, name));
+
+    log << "Наблюдение прервано: " << strerror(errno) << endl;
+    close(outputFd);
+    close(notify);
+    return 1;
+}
+
+#else
+
+int watchFile(const string& path, const WatchOptions& options, ostream& log) {
+    (void)path;
+    (void)options;
+    log << "Режим наблюдения поддерживается только в Linux" << endl;
+    return 1;
+}
+
+#endif
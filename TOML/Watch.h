@@ -0,0 +1,23 @@
+#pragma once
+
+#include <iosfwd>
+#include <string>
+
+#include "Converter.h"
+
+// РЕЖИМ НАБЛЮДЕНИЯ
+// Файл преобразуется один раз целиком, затем после каждого сохранения
+// преобразуется инкрементально: заново разбираются только изменённые
+// операторы, а в файл результата переписывается только изменённая часть.
+// Изменения отслеживаются через inotify и поддерживаются только в Linux.
+
+// Параметры наблюдения
+struct WatchOptions {
+    ConverterOptions converter;   // Параметры преобразования (печать токенов и AST не используется)
+    std::string outputPath;       // Файл результата (пусто - входной файл с расширением .toml)
+};
+
+// Наблюдение за файлом path до ошибки ввода-вывода. Сообщения о каждом
+// обновлении и ошибки преобразования пишутся в log; при ошибке файл
+// результата сохраняет последнюю успешную версию. Возвращает код завершения.
+int watchFile(const std::string& path, const WatchOptions& options, std::ostream& log);